@@ -1,9 +1,93 @@
 /**
  * Eva LLVM executable.
  */
+#include <charconv>
+#include <fstream>
 #include <string>
+#include "llvm/Support/Process.h"
 #include "./src/EvaLLVM.h" // Assuming EvaLLVM.h is in the same directory or include path
 
+/**
+ * Read-eval-print loop: evaluates the complete top-level forms of each
+ * line read from stdin in one session, so definitions persist across
+ * lines. A form may span several lines.
+ */
+int runRepl(EvaLLVM& vm) {
+    auto interactive = llvm::sys::Process::StandardInIsUserInput();
+
+    std::string buffer;
+    syntax::FormScanner scanner;
+    syntax::FormRange form;
+    std::string line;
+
+    for (;;) {
+        if (interactive) {
+            std::cout << (buffer.empty() ? "eva> " : "...> ") << std::flush;
+        }
+        if (!std::getline(std::cin, line)) {
+            break;
+        }
+        buffer += line;
+        buffer += '\n';
+
+        // The complete forms read so far make one input.
+        size_t end = 0;
+        while (scanner.next(buffer, /* eof */ false, form)) {
+            end = form.end;
+        }
+        if (end == 0) {
+            continue;
+        }
+
+        auto input = buffer.substr(0, end);
+        buffer.erase(0, end);
+        scanner.consume(end);
+
+        try {
+            vm.eval(input);
+        } catch (...) {
+            // A syntax or compile error, already reported.
+        }
+        std::fflush(stdout);
+    }
+
+    // A last form without a newline.
+    if (buffer.find_first_not_of(" \t\r\n") != std::string::npos) {
+        try {
+            vm.eval(buffer);
+        } catch (...) {
+        }
+    }
+    return 0;
+}
+
+/**
+ * Prints the command line to stderr.
+ */
+void printUsage() {
+    std::cerr << "Usage: EvaLLVM [--repl] [--jit [--lazy] [--speculate]] [-O0|-O1|-O2|-O3]\n"
+                 "               [--object=<file>] [--executable=<file>] [--emit=ll|bc|none]\n"
+                 "               [--output=<file>] [--dump] [--cache=<dir>]\n"
+                 "               [--codegen-threads=<n>] [--parse-threads=<n>]\n"
+                 "               [program file]\n";
+}
+
+/**
+ * Parses the thread count of an option, a whole positive number. Prints
+ * the usage and returns false if it is not one.
+ */
+bool parseThreads(const std::string& arg, size_t prefixSize, unsigned& threads) {
+    auto value = std::string_view(arg).substr(prefixSize);
+    auto end = value.data() + value.size();
+    auto [last, error] = std::from_chars(value.data(), end, threads);
+    if (error != std::errc() || last != end || threads == 0) {
+        std::cerr << "Invalid thread count in " << arg << "\n";
+        printUsage();
+        return false;
+    }
+    return true;
+}
+
 int main(int argc, char const *argv[]) {
     /**
      * Program to execute.
@@ -36,15 +120,112 @@ int main(int argc, char const *argv[]) {
         (printf "X: %d\n\n" x)
     )"; 
  
+    /**
+     * Command line: [--repl] [--jit [--lazy] [--speculate]] [-O0|-O1|-O2|-O3]
+     *               [--object=<file>]
+     *               [--executable=<file>] [--emit=ll|bc|none]
+     *               [--output=<file>] [--dump] [--cache=<dir>]
+     *               [--codegen-threads=<n>] [--parse-threads=<n>]
+     *               [program file]
+     *
+     * --repl evaluates stdin form by form in one JIT session.
+     * --jit runs the program in-process instead of writing ./out.ll.
+     * --lazy compiles each top-level function on its first call, so
+     * errors in its body are only reported then (never if it is not
+     * called), and --speculate compiles the functions it may call in the
+     * background.
+     * --emit and --output choose the format and path of the saved module
+     * (text IR to ./out.ll by default), --dump also prints it to stdout.
+     * --cache reuses optimized builds of the same program and options.
+     * --codegen-threads compiles top-level functions in parallel.
+     * --parse-threads parses programs of 1 MB or more in parallel (all
+     * hardware threads by default, 1 to stream them).
+     * -O<n> optimizes the module first, and reports the pipeline time.
+     * --object and --executable also emit native code for the host.
+     */
+    EvaOptions options;
+    const char* programFile = nullptr;
+    bool repl = false;
+
+    for (auto i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--repl") {
+            repl = true;
+        } else if (arg == "--jit") {
+            options.jit = true;
+        } else if (arg == "--lazy") {
+            options.lazy = true;
+        } else if (arg == "--speculate") {
+            options.lazy = true;
+            options.speculate = true;
+        } else if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 &&
+                   arg[2] >= '0' && arg[2] <= '3') {
+            options.optLevel = arg[2] - '0';
+        } else if (arg.rfind("--object=", 0) == 0) {
+            options.objectFile = arg.substr(9);
+        } else if (arg.rfind("--executable=", 0) == 0) {
+            options.executableFile = arg.substr(13);
+        } else if (arg == "--emit=ll") {
+            options.outputFormat = OutputFormat::Text;
+        } else if (arg == "--emit=bc") {
+            options.outputFormat = OutputFormat::Bitcode;
+        } else if (arg == "--emit=none") {
+            options.outputFormat = OutputFormat::None;
+        } else if (arg.rfind("--output=", 0) == 0) {
+            options.outputFile = arg.substr(9);
+        } else if (arg == "--dump") {
+            options.dumpModule = true;
+        } else if (arg.rfind("--cache=", 0) == 0) {
+            options.cacheDir = arg.substr(8);
+        } else if (arg.rfind("--codegen-threads=", 0) == 0) {
+            if (!parseThreads(arg, 18, options.codegenThreads)) {
+                return 1;
+            }
+        } else if (arg.rfind("--parse-threads=", 0) == 0) {
+            if (!parseThreads(arg, 16, options.parseThreads)) {
+                return 1;
+            }
+        } else {
+            programFile = argv[i];
+        }
+    }
+
     /**
      * Compiler instance.
      */
-    EvaLLVM vm;
+    EvaLLVM vm(options);
 
     /**
      * Generate LLVM IR and execute the program..
+     *
+     * A program file is compiled as a stream, one top-level form at a time,
+     * unless it is large enough to be parsed in parallel.
+     * In JIT mode the exit code is the one of the program's main.
      */
-    vm.exec(program);
+    int exitCode;
 
-    return 0;
+    if (repl) {
+        exitCode = runRepl(vm);
+    } else if (programFile != nullptr) {
+        std::ifstream input(programFile, std::ios::binary);
+        if (!input) {
+            std::cerr << "Cannot open " << programFile << "\n";
+            return 1;
+        }
+        exitCode = vm.exec(input);
+    } else {
+        exitCode = vm.exec(program);
+    }
+
+    if (options.optLevel > 0) {
+        std::cerr << "Optimization (O" << options.optLevel << "): "
+                  << vm.optimizationTime().count() * 1000 << " ms\n";
+    }
+
+    if (auto cache = vm.compileCache()) {
+        std::cerr << "Cache: " << cache->hits() << " hits, " << cache->misses()
+                  << " misses\n";
+    }
+
+    return exitCode;
 }
@@ -0,0 +1,432 @@
+/**
+ * Front-end benchmark suite: Tokenizer and EvaParser throughput.
+ *
+ * Runs both front-end stages over deterministic synthetic programs.
+ * Generators:
+ *
+ *   - flat:     one long list of numbers and short symbols;
+ *   - nested:   chains of lists nested 1000 deep;
+ *   - strings:  printf forms with long string literals;
+ *   - symbols:  var/set forms over many distinct, long identifiers;
+ *   - comments: short forms between line and block comments.
+ *
+ * Sizes go from 1 KB to 100 MB. Each (generator, size, stage) run is
+ * measured in a forked child process, so its peak RSS is its own; it
+ * includes the source buffer. For each run it reports tokens/s, MB/s,
+ * heap allocations per token and peak RSS, as one JSON object per line
+ * (or a table with --text), e.g. to diff against a previous run.
+ *
+ * Build and run from the repo root with bench/frontend-bench.sh, or:
+ *
+ *   clang++ -std=c++17 -O2 -fexceptions -o bench/FrontendBench \
+ *     bench/FrontendBench.cpp && ./bench/FrontendBench --max-size=10M
+ *
+ * Options:
+ *
+ *   --max-size=N[K|M]   largest program size (default 100M)
+ *   --generator=NAME    run a single generator
+ *   --stage=NAME        run a single stage (tokenizer, parser)
+ *   --text              human-readable output
+ */
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../src/parser/EvaParser.h"
+
+using syntax::EvaParser;
+
+// -----------------------------------------------------------------
+// Allocation counting.
+
+static size_t allocationsCount = 0;
+static size_t allocatedBytes = 0;
+
+// The replaced new and delete are not inlined: g++ would then see the
+// memory of malloc passed to operator delete, or the memory of operator
+// new to free, in the callers (-Wmismatched-new-delete).
+__attribute__((noinline)) void* operator new(size_t size) {
+    allocationsCount++;
+    allocatedBytes += size;
+    if (auto p = std::malloc(size == 0 ? 1 : size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+// Every delete goes through the unsized one, the pair of operator new.
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+// -----------------------------------------------------------------
+// Program generators.
+
+/**
+ * Deterministic generator state. Uses the raw engine output only: the
+ * standard distributions differ between library implementations.
+ */
+class Source {
+public:
+    explicit Source(size_t size) : rng_(20240901) { text_.reserve(size + 256); }
+
+    size_t pick(size_t count) { return rng_() % count; }
+
+    void append(const std::string& text) { text_ += text; }
+
+    void appendNumber() { text_ += std::to_string(pick(100000)); }
+
+    void appendSymbol(size_t minLength, size_t maxLength) {
+        static const char chars[] = "abcdefghijklmnopqrstuvwxyz_-";
+        auto length = minLength + pick(maxLength - minLength + 1);
+        text_ += chars[pick(26)];
+        for (size_t i = 1; i < length; i++) {
+            text_ += chars[pick(sizeof(chars) - 1)];
+        }
+    }
+
+    void appendWords(size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            if (i > 0) {
+                text_ += ' ';
+            }
+            appendSymbol(2, 9);
+        }
+    }
+
+    size_t size() const { return text_.size(); }
+
+    std::string take() { return std::move(text_); }
+
+private:
+    std::mt19937 rng_;
+    std::string text_;
+};
+
+/**
+ * (list 42 abc 17 ...)
+ */
+std::string generateFlat(size_t size) {
+    Source source(size);
+    source.append("(list");
+    while (source.size() < size) {
+        source.append(" ");
+        if (source.pick(2) == 0) {
+            source.appendNumber();
+        } else {
+            source.appendSymbol(1, 6);
+        }
+    }
+    source.append(")");
+    return source.take();
+}
+
+/**
+ * (begin (x (x (x ... 42))) ...), 1000 levels per chain.
+ */
+std::string generateNested(size_t size) {
+    Source source(size);
+    source.append("(begin");
+    while (source.size() < size) {
+        source.append("\n");
+        for (auto depth = 0; depth < 1000; depth++) {
+            source.append("(x ");
+        }
+        source.appendNumber();
+        source.append(std::string(1000, ')'));
+    }
+    source.append(")");
+    return source.take();
+}
+
+/**
+ * (begin (printf "words words ... %d\n" 42) ...)
+ */
+std::string generateStrings(size_t size) {
+    Source source(size);
+    source.append("(begin");
+    while (source.size() < size) {
+        source.append("\n  (printf \"");
+        source.appendWords(3 + source.pick(10));
+        source.append(": %d\\n\" ");
+        source.appendNumber();
+        source.append(")");
+    }
+    source.append(")");
+    return source.take();
+}
+
+/**
+ * (begin (var some_long_name other_name) (set ...) ...)
+ */
+std::string generateSymbols(size_t size) {
+    Source source(size);
+    source.append("(begin");
+    while (source.size() < size) {
+        source.append(source.pick(2) == 0 ? "\n  (var " : "\n  (set ");
+        source.appendSymbol(4, 24);
+        source.append(" ");
+        source.appendSymbol(4, 24);
+        source.append(")");
+    }
+    source.append(")");
+    return source.take();
+}
+
+/**
+ * (begin // words ... (set x 42) ...), also with block comments.
+ */
+std::string generateComments(size_t size) {
+    Source source(size);
+    source.append("(begin");
+    while (source.size() < size) {
+        if (source.pick(2) == 0) {
+            source.append("\n  // ");
+            source.appendWords(4 + source.pick(12));
+        } else {
+            source.append("\n  /* ");
+            source.appendWords(4 + source.pick(12));
+            source.append("\n     ");
+            source.appendWords(4 + source.pick(12));
+            source.append(" */");
+        }
+        source.append("\n  (set x ");
+        source.appendNumber();
+        source.append(")");
+    }
+    source.append(")");
+    return source.take();
+}
+
+struct Generator {
+    const char* name;
+    std::string (*generate)(size_t size);
+};
+
+const Generator generators[] = {
+    {"flat", generateFlat},         {"nested", generateNested},
+    {"strings", generateStrings},   {"symbols", generateSymbols},
+    {"comments", generateComments},
+};
+
+const size_t sizes[] = {
+    1 << 10, 16 << 10, 256 << 10, 1 << 20, 10 << 20, 100 << 20,
+};
+
+// -----------------------------------------------------------------
+// Measurement.
+
+/**
+ * Result of one run, passed from the child process.
+ */
+struct Result {
+    bool ok;
+    size_t bytes;
+    size_t tokens;
+    size_t iterations;
+    double seconds;
+    size_t allocations;
+    size_t allocatedBytes;
+    long peakRssKb;
+};
+
+/**
+ * Number of tokens in the source, EOF excluded.
+ */
+size_t countTokens(const std::string& source) {
+    syntax::Tokenizer tokenizer;
+    tokenizer.initString(source);
+    size_t count = 0;
+    while (tokenizer.getNextToken().type != syntax::TokenType::__EOF) {
+        count++;
+    }
+    return count;
+}
+
+/**
+ * Runs one stage over the source for at least 0.5s (at least once).
+ * Allocations are those of the first iteration.
+ */
+Result runStage(const std::string& stage, const std::string& source) {
+    Result result{};
+    result.bytes = source.size();
+    result.tokens = countTokens(source);
+
+    EvaParser parser;
+
+    auto iteration = [&]() {
+        if (stage == "tokenizer") {
+            syntax::Tokenizer tokenizer;
+            tokenizer.initString(source);
+            while (tokenizer.getNextToken().type != syntax::TokenType::__EOF) {
+            }
+        } else {
+            AstContext context;
+            AstContext::Scope scope(context);
+            parser.parse(source);
+        }
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed{};
+
+    do {
+        auto allocationsBefore = allocationsCount;
+        auto bytesBefore = allocatedBytes;
+
+        iteration();
+
+        if (result.iterations++ == 0) {
+            result.allocations = allocationsCount - allocationsBefore;
+            result.allocatedBytes = allocatedBytes - bytesBefore;
+        }
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < 0.5);
+
+    result.seconds = elapsed.count() / result.iterations;
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    result.peakRssKb = usage.ru_maxrss;
+
+    result.ok = true;
+    return result;
+}
+
+/**
+ * Generates the program and runs the stage in a child process.
+ */
+Result measure(const Generator& generator, size_t size, const std::string& stage) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        std::perror("pipe");
+        std::exit(EXIT_FAILURE);
+    }
+
+    auto pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        Result result{};
+        try {
+            result = runStage(stage, generator.generate(size));
+        } catch (...) {
+            result.ok = false;
+        }
+        auto written = write(fds[1], &result, sizeof(result));
+        _exit(written == sizeof(result) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    Result result{};
+    if (read(fds[0], &result, sizeof(result)) != sizeof(result)) {
+        result.ok = false;
+    }
+    close(fds[0]);
+    waitpid(pid, nullptr, 0);
+    return result;
+}
+
+/**
+ * Parses a size like 4096, 64K or 100M.
+ */
+size_t parseSize(const std::string& text) {
+    auto size = std::strtoull(text.c_str(), nullptr, 10);
+    switch (text.empty() ? 0 : text.back()) {
+        case 'K': case 'k': return size << 10;
+        case 'M': case 'm': return size << 20;
+        default: return size;
+    }
+}
+
+int main(int argc, char const *argv[]) {
+    size_t maxSize = 100 << 20;
+    std::string onlyGenerator;
+    std::string onlyStage;
+    bool text = false;
+
+    for (auto i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--max-size=", 0) == 0) {
+            maxSize = parseSize(arg.substr(11));
+        } else if (arg.rfind("--generator=", 0) == 0) {
+            onlyGenerator = arg.substr(12);
+        } else if (arg.rfind("--stage=", 0) == 0) {
+            onlyStage = arg.substr(8);
+        } else if (arg == "--text") {
+            text = true;
+        } else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (text) {
+        std::printf("%-10s %-9s %10s %10s %12s %9s %12s %10s\n", "stage",
+                    "generator", "bytes", "tokens", "tokens/s", "MB/s",
+                    "allocs/tok", "RSS MB");
+    }
+
+    for (auto& generator : generators) {
+        if (!onlyGenerator.empty() && onlyGenerator != generator.name) {
+            continue;
+        }
+        for (auto size : sizes) {
+            if (size > maxSize) {
+                continue;
+            }
+            for (std::string stage : {"tokenizer", "parser"}) {
+                if (!onlyStage.empty() && onlyStage != stage) {
+                    continue;
+                }
+
+                auto result = measure(generator, size, stage);
+                if (!result.ok) {
+                    std::cerr << stage << " failed on " << generator.name
+                              << " (" << size << " bytes)\n";
+                    return EXIT_FAILURE;
+                }
+
+                auto tokensPerSecond = result.tokens / result.seconds;
+                auto mbPerSecond = result.bytes / result.seconds / (1 << 20);
+                auto allocationsPerToken =
+                    (double)result.allocations / std::max<size_t>(result.tokens, 1);
+
+                if (text) {
+                    std::printf("%-10s %-9s %10zu %10zu %12.4g %9.1f %12.4g %10.1f\n",
+                                stage.c_str(), generator.name, result.bytes,
+                                result.tokens, tokensPerSecond, mbPerSecond,
+                                allocationsPerToken, result.peakRssKb / 1024.0);
+                } else {
+                    std::printf(
+                        "{\"stage\":\"%s\",\"generator\":\"%s\",\"bytes\":%zu,"
+                        "\"tokens\":%zu,\"iterations\":%zu,\"seconds\":%.6g,"
+                        "\"tokensPerSecond\":%.6g,\"mbPerSecond\":%.6g,"
+                        "\"allocations\":%zu,\"allocatedBytes\":%zu,"
+                        "\"allocationsPerToken\":%.6g,\"peakRssBytes\":%ld}\n",
+                        stage.c_str(), generator.name, result.bytes, result.tokens,
+                        result.iterations, result.seconds, tokensPerSecond,
+                        mbPerSecond, result.allocations, result.allocatedBytes,
+                        allocationsPerToken, result.peakRssKb * 1024);
+                }
+                std::fflush(stdout);
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,241 @@
+/**
+ * Shift/reduce throughput micro-benchmark for EvaParser.
+ *
+ * Reports LR actions (shifts + reduces) per second for:
+ *
+ *   - the table-driven automaton alone, replaying the token stream of a
+ *     synthetic program through the dense parsing table, and through the
+ *     same table laid out as a `std::map` per row (the previous layout);
+ *
+ *   - full `EvaParser::parse` calls, including the semantic actions;
+ *
+ *   - parse time per element of flat lists growing up to 1M elements,
+ *     which stays flat as long as list construction is linear. Exits
+ *     with a failure if it grows by more than MAX_SCALING_FACTOR from
+ *     125k to 1M elements.
+ *
+ * Build and run from the repo root:
+ *
+ *   clang++ $(llvm-config --cxxflags) -std=c++17 -O2 -fexceptions \
+ *     -o bench/ParserBench bench/ParserBench.cpp && ./bench/ParserBench
+ */
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "../src/parser/EvaParser.h"
+
+using syntax::EvaParser;
+using syntax::TableEntry;
+using syntax::TE;
+
+/**
+ * Bound on the growth of parse time per element from the smallest to the
+ * largest list, and the runs each size is timed over.
+ */
+constexpr double MAX_SCALING_FACTOR = 2.0;
+constexpr int SCALING_RUNS = 3;
+
+/**
+ * Generates a program of `forms` pairs of small forms within a `begin`.
+ */
+std::string generateProgram(int forms) {
+    std::string source = "(begin";
+    for (auto i = 0; i < forms; i++) {
+        source += " (var (x number) 42)";
+        source += " (printf \"X: %d\\n\" (+ x 1))";
+    }
+    source += ")";
+    return source;
+}
+
+/**
+ * Generates a flat list of `size` number atoms.
+ */
+std::string generateList(int size) {
+    std::string source = "(";
+    for (auto i = 0; i < size; i++) {
+        source += " 42";
+    }
+    source += ")";
+    return source;
+}
+
+/**
+ * Encoded token types of the program, up to and including EOF.
+ */
+std::vector<int> tokenize(const std::string& source) {
+    syntax::Tokenizer tokenizer;
+    tokenizer.initString(source);
+
+    std::vector<int> tokens;
+    for (;;) {
+        auto token = tokenizer.getNextToken();
+        tokens.push_back((int)token.type);
+        if (token.type == syntax::TokenType::__EOF) {
+            return tokens;
+        }
+    }
+}
+
+/**
+ * Runs the LR automaton over the token stream without semantic actions.
+ * Returns the number of shifts and reduces performed.
+ */
+template <typename Lookup>
+long recognize(const std::vector<int>& tokens, std::vector<int>& states,
+               Lookup lookup) {
+    long actions = 0;
+    size_t cursor = 0;
+
+    states.clear();
+    states.push_back(0);
+
+    for (;;) {
+        auto entry = lookup(states.back(), tokens[cursor]);
+
+        switch (entry.type) {
+            case TE::Shift:
+                states.push_back(entry.value);
+                cursor++;
+                actions++;
+                break;
+
+            case TE::Reduce: {
+                auto& production = EvaParser::production(entry.value);
+                states.resize(states.size() - production.rhsLength);
+                states.push_back(lookup(states.back(), production.opcode).value);
+                actions++;
+                break;
+            }
+
+            case TE::Accept:
+                return actions;
+
+            default:
+                std::cerr << "Benchmark program failed to parse.\n";
+                std::exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/**
+ * Calls `fn` in batches for about a second. Returns calls per second.
+ */
+template <typename Fn>
+double measure(Fn fn) {
+    // Warm up.
+    for (auto i = 0; i < 1000; i++) {
+        fn();
+    }
+
+    long calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed{};
+
+    do {
+        for (auto i = 0; i < 1000; i++) {
+            fn();
+        }
+        calls += 1000;
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < 1.0);
+
+    return calls / elapsed.count();
+}
+
+int main() {
+    auto source = generateProgram(8);
+    auto tokens = tokenize(source);
+
+    // The previous table layout: a map from encoded symbol to entry per row.
+    std::array<std::map<int, TableEntry>, EvaParser::ROWS_COUNT> mapTable;
+    for (auto state = 0; state < (int)EvaParser::ROWS_COUNT; state++) {
+        for (auto symbol = 0; symbol < (int)EvaParser::COLUMNS_COUNT; symbol++) {
+            auto& entry = EvaParser::action(state, symbol);
+            if (entry.type != TE::Error) {
+                mapTable[state][symbol] = entry;
+            }
+        }
+    }
+
+    std::vector<int> states;
+    auto denseLookup = [](int state, int symbol) {
+        return EvaParser::action(state, symbol);
+    };
+    auto mapLookup = [&mapTable](int state, int symbol) {
+        auto& row = mapTable[state];
+        if (row.count(symbol) == 0) {
+            return TableEntry{TE::Error, 0};
+        }
+        return row.at(symbol);
+    };
+
+    auto actions = recognize(tokens, states, denseLookup);
+
+    auto denseRate = measure([&] { recognize(tokens, states, denseLookup); });
+    auto mapRate = measure([&] { recognize(tokens, states, mapLookup); });
+
+    EvaParser parser;
+    auto parseRate = measure([&] {
+        AstContext context;
+        AstContext::Scope scope(context);
+        parser.parse(source);
+    });
+
+    std::cout << "actions/parse:               " << actions << "\n"
+              << "automaton, dense table:      "
+              << denseRate * actions / 1e6 << " Mactions/s\n"
+              << "automaton, map rows:         "
+              << mapRate * actions / 1e6 << " Mactions/s\n"
+              << "EvaParser::parse:            "
+              << parseRate * actions / 1e6 << " Mactions/s\n";
+
+    // Scaling check: linear list construction keeps ns/element flat,
+    // a quadratic one multiplies it by 8 from 125k to 1M elements.
+    double smallest = 0;
+    double largest = 0;
+
+    for (auto size : {125000, 250000, 500000, 1000000}) {
+        auto list = generateList(size);
+
+        // Best of a few runs, to keep a single slow run from failing the
+        // check.
+        double best = 0;
+        for (auto run = 0; run < SCALING_RUNS; run++) {
+            AstContext context;
+            AstContext::Scope scope(context);
+
+            auto start = std::chrono::steady_clock::now();
+            auto ast = parser.parse(list);
+            std::chrono::duration<double, std::nano> elapsed =
+                std::chrono::steady_clock::now() - start;
+
+            auto perElement = elapsed.count() / ast.list().size();
+            if (run == 0 || perElement < best) {
+                best = perElement;
+            }
+        }
+
+        std::cout << "list of " << size << " elements:  " << best
+                  << " ns/element\n";
+
+        if (smallest == 0) {
+            smallest = best;
+        }
+        largest = best;
+    }
+
+    if (largest > smallest * MAX_SCALING_FACTOR) {
+        std::cerr << "Parse time per element grew " << largest / smallest
+                  << "x from 125k to 1M elements (limit "
+                  << MAX_SCALING_FACTOR << "x): list parsing is not linear.\n";
+        return EXIT_FAILURE;
+    }
+
+    return 0;
+}
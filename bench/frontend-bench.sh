@@ -0,0 +1,15 @@
+#!/bin/bash
+
+# Builds and runs the front-end benchmark suite (bench/FrontendBench.cpp).
+# Options are passed through, e.g.:
+#
+#   ./bench/frontend-bench.sh --max-size=10M --text
+#   ./bench/frontend-bench.sh > frontend.jsonl
+
+cd "$(dirname "$0")/.."
+
+# Compile the benchmark with clang++ (override with CXX and CXXFLAGS)
+${CXX:-clang++} -std=c++17 -O2 -fexceptions ${CXXFLAGS} -o bench/FrontendBench bench/FrontendBench.cpp || exit $?
+
+# Run it
+./bench/FrontendBench "$@"
@@ -7,7 +7,7 @@ INCLUDE_PATHS="-isystem /usr/include/c++/11 -isystem /usr/include/x86_64-linux-g
 LIBRARY_PATH="-L/usr/lib/x86_64-linux-gnu"
 
 # Compile the C++ code with clang++
-clang++ -v $(llvm-config --cxxflags --ldflags --system-libs --libs core) $INCLUDE_PATHS $LIBRARY_PATH -fexceptions -o EvaLLVM EvaLLVM.cpp
+clang++ -v $(llvm-config --cxxflags --ldflags --system-libs --libs core orcjit native passes bitreader bitwriter linker) -std=c++17 -pthread $INCLUDE_PATHS $LIBRARY_PATH -fexceptions -o EvaLLVM EvaLLVM.cpp
 
 # Run the compiled executable
 ./EvaLLVM
@@ -0,0 +1,172 @@
+/**
+ * Content-addressed on-disk compilation cache.
+ */
+
+#ifndef CompileCache_h
+#define CompileCache_h
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+/**
+ * Stores compiled artifacts (bitcode, objects) in a directory, under the
+ * SHA1 of the source, the compiler version and options, and the LLVM
+ * version.
+ *
+ * Entries are written to a temporary file and renamed into place, so
+ * concurrent compilers never see a partial entry. The directory is kept
+ * under a size cap by evicting the least recently used entries; a hit
+ * refreshes the entry's timestamps.
+ */
+class CompileCache {
+public:
+    CompileCache(std::string directory, uint64_t maxBytes)
+        : directory_(std::move(directory)), maxBytes_(maxBytes) {
+        llvm::sys::fs::create_directories(directory_);
+    }
+
+    /**
+     * Key of a source compiled by the given compiler version (bumped by
+     * the compiler whenever its generated code changes) with the given
+     * options.
+     */
+    static std::string key(std::string_view source, std::string_view compilerVersion,
+                           std::string_view options) {
+        llvm::SHA1 hash;
+        hash.update(FORMAT_VERSION);
+        hash.update(LLVM_VERSION_STRING);
+        hash.update(llvm::StringRef(compilerVersion.data(), compilerVersion.size()));
+        hash.update(llvm::StringRef(options.data(), options.size()));
+        hash.update(llvm::StringRef(source.data(), source.size()));
+        return llvm::toHex(hash.final(), /* lowercase */ true);
+    }
+
+    /**
+     * Returns the entry with the given key and extension, or null on a
+     * miss. A compile looks up several entries under its key (bitcode,
+     * then object), only the first lookup of a key is counted.
+     */
+    std::unique_ptr<llvm::MemoryBuffer> lookup(const std::string& key,
+                                               std::string_view extension) {
+        auto path = entryPath_(key, extension);
+        auto counted = key != countedKey_;
+        countedKey_ = key;
+
+        auto file = llvm::sys::fs::openNativeFileForRead(path);
+        if (!file) {
+            llvm::consumeError(file.takeError());
+            misses_ += counted;
+            return nullptr;
+        }
+
+        auto buffer = llvm::MemoryBuffer::getOpenFile(
+            *file, path, /* FileSize */ -1, /* RequiresNullTerminator */ false);
+
+        // Pruning evicts by access time, which noatime mounts never update.
+        if (buffer) {
+            llvm::sys::fs::setLastAccessAndModificationTime(
+                *file, std::chrono::system_clock::now());
+        }
+        llvm::sys::fs::closeFile(*file);
+
+        if (!buffer) {
+            misses_ += counted;
+            return nullptr;
+        }
+
+        hits_ += counted;
+        return std::move(*buffer);
+    }
+
+    /**
+     * Atomically stores an entry, then evicts old entries if the cache is
+     * over its size cap. Failures only mean the entry is not cached.
+     */
+    void store(const std::string& key, std::string_view extension,
+               llvm::StringRef data) {
+        int fd;
+        llvm::SmallString<128> tempPath;
+        if (llvm::sys::fs::createUniqueFile(
+                directory_ + "/" + TEMP_PREFIX + "%%%%%%%%", fd, tempPath)) {
+            return;
+        }
+
+        {
+            llvm::raw_fd_ostream out(fd, /* shouldClose */ true);
+            out << data;
+            out.close();
+            if (out.has_error()) {
+                out.clear_error();
+                llvm::sys::fs::remove(tempPath);
+                return;
+            }
+        }
+
+        if (llvm::sys::fs::rename(tempPath, entryPath_(key, extension))) {
+            llvm::sys::fs::remove(tempPath);
+            return;
+        }
+
+        prune_();
+    }
+
+    /**
+     * Compiles that found their entry.
+     */
+    uint64_t hits() const { return hits_; }
+
+    /**
+     * Compiles that found none.
+     */
+    uint64_t misses() const { return misses_; }
+
+private:
+    /**
+     * Bumped when the layout of the entries changes.
+     */
+    static constexpr const char* FORMAT_VERSION = "eva-cache-1";
+
+    /**
+     * Prefix of entries being written. Not llvmcache-*, so that pruning
+     * never evicts a file before it is renamed into place.
+     */
+    static constexpr const char* TEMP_PREFIX = "eva-tmp-";
+
+    /**
+     * Entries are named llvmcache-*, the names llvm::pruneCache manages.
+     */
+    std::string entryPath_(const std::string& key, std::string_view extension) const {
+        return directory_ + "/llvmcache-" + key + std::string(extension);
+    }
+
+    void prune_() {
+        llvm::CachePruningPolicy policy;
+        policy.Interval = std::chrono::seconds(0);
+        policy.MaxSizeBytes = maxBytes_;
+        llvm::pruneCache(directory_, policy);
+    }
+
+    std::string directory_;
+
+    uint64_t maxBytes_;
+
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    std::string countedKey_;
+};
+
+#endif
@@ -39,6 +39,20 @@ public:
         return resolve(name)->record_[name];
     }
 
+    /**
+     * Whether a variable is defined in this environment itself.
+     */
+    bool defines(const std::string& name) const {
+        return record_.count(name) != 0;
+    }
+
+    /**
+     * Parent environment, null for the global one.
+     */
+    std::shared_ptr<Environment> parent() const {
+        return parent_;
+    }
+
 private:
 
     /**
@@ -50,7 +64,7 @@ private:
             return shared_from_this();
         }
         if (parent_ == nullptr){
-            DIE << "Variable \"" << name << "\" is not defined.";
+            DIE << "Variable \"" << name << "\" is not defined.\n";
         }
         return parent_->resolve(name);
     }
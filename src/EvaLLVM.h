@@ -1,17 +1,51 @@
 #ifndef EvaLLVM_h
 #define EvaLLVM_h
 
+#include <chrono>
+#include <map>
 #include <iostream>
-#include <regex>
+#include <iterator>
+#include <mutex>
+#include <set>
 #include <string>
-
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LazyReexports.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
-
+#include "llvm/Linker/Linker.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/SmallVectorMemoryBuffer.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include "./CompileCache.h"
 #include "./Environment.h"
+#include "./LazyUnit.h"
+#include "./ThreadPool.h"
+#include "./TypeInference.h"
 #include "parser/EvaParser.h"
+#include "parser/FormScanner.h"
 
 using syntax::EvaParser;
 
@@ -20,208 +54,3029 @@ using syntax::EvaParser;
  */
 using Env = std::shared_ptr<Environment>;
 
+/**
+ * Output format of the compiled module.
+ */
+enum class OutputFormat {
+    // Textual IR (.ll)
+    Text,
+
+    // Binary bitcode (.bc)
+    Bitcode,
+
+    // No output
+    None,
+};
+
+/**
+ * Compiler options.
+ */
+struct EvaOptions {
+    /**
+     * Threads used to parse large programs.
+     */
+    unsigned parseThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    /**
+     * Runs `main` in-process with the ORC JIT instead of saving the
+     * module.
+     */
+    bool jit = false;
+
+    /**
+     * In JIT mode, generates and optimizes each top-level function on its
+     * first call instead of before `main` runs. Ignored when the whole
+     * module is needed: with a cache, --dump or native output.
+     *
+     * The program is still checked up front for duplicate defs and calls
+     * ahead of a def, but errors in a function's body (an undefined
+     * variable, a type error) are only reported on its first call, and
+     * not at all if it is never called.
+     */
+    bool lazy = false;
+
+    /**
+     * With `lazy`, compiles the functions referred to by `main` and by
+     * each compiled function on the thread pool, ahead of their first
+     * call.
+     */
+    bool speculate = false;
+
+    /**
+     * Format the module is saved in.
+     */
+    OutputFormat outputFormat = OutputFormat::Text;
+
+    /**
+     * Stream the module is written to. If null, it is saved to
+     * `outputFile`.
+     */
+    llvm::raw_ostream* outputStream = nullptr;
+
+    /**
+     * Path the module is saved to, ./out.ll or ./out.bc if empty.
+     */
+    std::string outputFile;
+
+    /**
+     * Also prints the module as text to stdout.
+     */
+    bool dumpModule = false;
+
+    /**
+     * Optimization level, 0 to 3: the new pass manager's default
+     * pipeline run on the module before it is output or run.
+     */
+    unsigned optLevel = 0;
+
+    /**
+     * Native object file to emit for the host, if not empty.
+     */
+    std::string objectFile;
+
+    /**
+     * Executable to link from the object file with the system C
+     * compiler driver, if not empty.
+     */
+    std::string executableFile;
+
+    /**
+     * Directory of the compilation cache, disabled if empty.
+     */
+    std::string cacheDir;
+
+    /**
+     * Size cap of the compilation cache.
+     */
+    uint64_t cacheMaxBytes = 256 * 1024 * 1024;
+
+    /**
+     * Threads generating and optimizing top-level functions, each in its
+     * own context and module. 1 compiles everything into one module.
+     */
+    unsigned codegenThreads = 1;
+};
+
 class EvaLLVM {
 public:
-    EvaLLVM() : parser(std::make_unique<EvaParser>()){
-        moduleInit();
-        setupExternalFunctions();
-        setupGlobalEnvironment();
-    }
+    explicit EvaLLVM(const EvaOptions& options = EvaOptions())
+        : EvaLLVM(options, /* unit */ false) {}
 
     // Executes a program.
-    void exec(const std::string& program) {
-        // 1. Parse the program
-        auto ast = parser->parse("(begin " + program + ")");
+    //
+    // Returns the exit code of `main` in JIT mode, 0 otherwise.
+    int exec(const std::string& program) {
+        // 0. A cached build of the same program and options skips the
+        //    front end, gen and optimization
+        if (cache != nullptr){
+            cacheKey_ = CompileCache::key(program, CODEGEN_VERSION, cacheOptions());
+            if (loadCachedModule()){
+                return finish();
+            }
+        }
+
+        // 1. Parse the program, AST nodes live in the compilation's arenas
+        AstContext astContext;
+        AstContext::Scope astScope(astContext);
+        std::vector<std::unique_ptr<AstContext>> chunkContexts;
+
+        auto ast = options.parseThreads > 1 &&
+                           program.size() >= PARALLEL_PARSE_MIN_SIZE
+                       ? parseParallel(program, astContext, chunkContexts)
+                       : parser->parse("(begin " + program + ")");
+        types->infer(&ast, 1);
 
         // 2. Compile to LLVM IR
-        //compile(ast);
-        compile(ast);
+        if (options.codegenThreads > 1 || lazyJIT()){
+            compileParallel(ast);
+        } else {
+            compile(ast);
+        }
+
+        // 3. Run, or print and save the module
+        return finish();
+    }
 
-        //Print generated code
-        module->print(llvm::outs(), nullptr);
+    // Executes a program read incrementally from a stream.
+    //
+    // Top-level forms are parsed and compiled into `main` one at a time,
+    // and the AST of each form is dropped as soon as it is compiled, so
+    // peak memory is bounded by the largest form, not the whole program.
+    // A file of PARALLEL_PARSE_MIN_SIZE or more is read whole and parsed
+    // in parallel instead, with more than one parse thread.
+    //
+    // Types are inferred for the whole program first, in passes over the
+    // stream, so a file compiles the same as the whole program: the
+    // stream must be seekable, other streams (a pipe) are read whole.
+    int exec(std::istream& input) {
+        // With a cache, the whole source is needed first for its key, and
+        // top-level functions are split out of the whole program. A large
+        // program is parsed in parallel, which needs it whole too.
+        auto start = input.tellg();
+        if (cache != nullptr || options.codegenThreads > 1 || lazyJIT() ||
+            start == std::istream::pos_type(-1) ||
+            (options.parseThreads > 1 && remainingSize(input) >= PARALLEL_PARSE_MIN_SIZE)){
+            input.clear();
+            std::string program(std::istreambuf_iterator<char>(input), {});
+            return exec(program);
+        }
+
+        // 1. Infer the types of the top-level bindings, until they are
+        //    stable
+        types->beginProgram();
+        do {
+            rewind(input, start);
+            types->beginProgramPass();
+            forEachForm(input, [&](const Exp& form) { types->infer(&form, 1); });
+        } while (types->endProgramPass());
+
+        // 2. Open main, top-level forms share one block scope
+        //    as in (begin <program>)
+        beginMain();
+
+        auto programEnv = std::make_shared<Environment>(
+            std::map<std::string, llvm::Value*>{}, GlobalEnv);
+
+        // 3. Parse and compile each form once it is complete
+        rewind(input, start);
+        types->beginProgramPass();
+        llvm::Value* result = builder->getInt32(0);
+        forEachForm(input, [&](const Exp& form) {
+            types->infer(&form, 1);
+            result = gen(form, programEnv);
+        });
+        types->endProgram();
+
+        // Top-level heap arrays are freed at the end, as those of a block.
+        freeHeapArrays(programEnv, result);
+        endMain();
+
+        // 4. Run, or print and save the module
+        return finish();
+    }
+
+    // Evaluates an input in the session of this compiler: its top-level
+    // forms are compiled into a module of their own, added to the
+    // session's JIT and run at once. The JIT, the global environment and
+    // the globals stay alive across inputs, so top-level variables and
+    // functions of earlier inputs stay visible.
+    //
+    // Top-level variables of an input are globals, not locals of `main`.
+    // A def of an earlier input is replaced by a later def of the same
+    // name. An instance used for a session is not used for exec.
+    //
+    // Errors are recoverable: an input that does not compile throws a
+    // CompileError (after reporting it) and leaves the session as it was.
+    //
+    // Returns the exit code of the input's code.
+    int eval(const std::string& input) {
+        ErrorLogMessage::recoverable = true;
+
+        // 1. Parse first: a syntax error leaves the session as it was
+        AstContext astContext;
+        AstContext::Scope astScope(astContext);
+        auto ast = parser->parse("(begin " + input + ")");
+        types->infer(ast.list().begin() + 1, ast.list().size() - 1);
+
+        // 2. Compile the forms into a fresh module, in the global scope
+        auto globals = sessionGlobals;
+        auto symbols = sessionSymbols;
+        llvm::JITTargetAddress inputAddress = 0;
+        try {
+            beginInput();
+            for (size_t i = 1; i < ast.list().size(); i++){
+                gen(ast.list()[i], GlobalEnv);
+            }
+            builder->CreateRet(builder->getInt32(0));
+
+            optimizeModule();
+            if (options.dumpModule){
+                module->print(llvm::outs(), nullptr);
+                llvm::outs().flush();
+            }
+
+            // 3. Link
+            inputAddress = addInput();
+        } catch (const CompileError&) {
+            // The globals and defs of the input are dropped with its module.
+            sessionGlobals = std::move(globals);
+            sessionSymbols = std::move(symbols);
+            module.reset();
+            throw;
+        }
 
-        std::cout << "\n";
+        // 4. Run
+        auto inputFn = reinterpret_cast<int (*)()>(inputAddress);
+        return inputFn();
+    }
 
-        // 3. Save module IR to file
-        saveModuleToFile("./out.ll"); 
+    /**
+     * Time taken by the optimization pipeline of the last exec.
+     */
+    std::chrono::duration<double> optimizationTime() const {
+        return optimizationTime_;
     }
 
+    /**
+     * Compilation cache, null if disabled.
+     */
+    const CompileCache* compileCache() const { return cache.get(); }
+
 private:
+    /**
+     * Creates the compiler of a program, or of a single top-level
+     * function (`unit`): a unit compiler declares the globals of the
+     * program instead of defining them.
+     */
+    EvaLLVM(const EvaOptions& options, bool unit)
+        : options(options), isUnit(unit), parser(std::make_unique<EvaParser>()){
+        setupTargetMachine();
+        moduleInit();
+        setupExternalFunctions();
+        setupGlobalEnvironment();
+        setupSpecialForms();
+
+        if (!options.cacheDir.empty() && !unit){
+            cache = std::make_unique<CompileCache>(options.cacheDir,
+                                                   options.cacheMaxBytes);
+        }
+    }
+
+    /**
+     * Special form handler.
+     */
+    using SpecialForm = llvm::Value* (EvaLLVM::*)(const Exp&, Env);
+
+    /**
+     * Operator of an operator form: an arithmetic instruction, or a
+     * comparison (ICmp or FCmp with its predicate). Registered for
+     * integers, `onFloats` gives the f64 instruction.
+     */
+    struct Operator {
+        unsigned opcode = 0;
+        llvm::CmpInst::Predicate predicate = llvm::CmpInst::BAD_ICMP_PREDICATE;
+
+        bool isDefined() const { return opcode != 0; }
+        bool isComparison() const {
+            return opcode == llvm::Instruction::ICmp || opcode == llvm::Instruction::FCmp;
+        }
+
+        llvm::Instruction::BinaryOps binaryOp() const {
+            return static_cast<llvm::Instruction::BinaryOps>(opcode);
+        }
+
+        /**
+         * The operator on f64 operands: comparisons are ordered, but !=
+         * is unordered (true for NaN), as in C.
+         */
+        Operator onFloats() const {
+            switch (opcode){
+                case llvm::Instruction::Add: return {llvm::Instruction::FAdd};
+                case llvm::Instruction::Sub: return {llvm::Instruction::FSub};
+                case llvm::Instruction::Mul: return {llvm::Instruction::FMul};
+                case llvm::Instruction::SDiv: return {llvm::Instruction::FDiv};
+            }
+            switch (predicate){
+                case llvm::CmpInst::ICMP_SLT: return {llvm::Instruction::FCmp, llvm::CmpInst::FCMP_OLT};
+                case llvm::CmpInst::ICMP_SGT: return {llvm::Instruction::FCmp, llvm::CmpInst::FCMP_OGT};
+                case llvm::CmpInst::ICMP_SLE: return {llvm::Instruction::FCmp, llvm::CmpInst::FCMP_OLE};
+                case llvm::CmpInst::ICMP_SGE: return {llvm::Instruction::FCmp, llvm::CmpInst::FCMP_OGE};
+                case llvm::CmpInst::ICMP_EQ: return {llvm::Instruction::FCmp, llvm::CmpInst::FCMP_OEQ};
+                default: return {llvm::Instruction::FCmp, llvm::CmpInst::FCMP_UNE};
+            }
+        }
+    };
+
+    /**
+     * Declares the function defined by a unit form (its prototype), so
+     * that other modules can call it.
+     */
+    using UnitDeclaration = llvm::Function* (EvaLLVM::*)(const Exp&, Env);
 
     void compile(const Exp& ast){
         // 1. create main function
+        beginMain();
+
+        // 2. compile main body
+        gen(ast, GlobalEnv);
+
+        // 3. return from main
+        endMain();
+    }
+
+    /**
+     * Compiles the program with each top-level unit form (a function
+     * definition) generated and optimized in its own context and module
+     * on the thread pool, while `main` is compiled on this thread from
+     * the remaining forms.
+     *
+     * Every module first declares the functions of all units, so calls
+     * across modules resolve at link time, or in the JIT. The program is
+     * checked first to be valid in order, see checkUnitOrder.
+     */
+    void compileParallel(const Exp& ast){
+        checkUnitOrder(ast);
+
+        std::vector<const Exp*> units;
+        std::vector<Exp> rest;
+        for (const auto& form : ast.list()){
+            if (isUnitForm(form)){
+                units.push_back(&form);
+            } else {
+                rest.push_back(form);
+            }
+        }
+
+        if (units.empty()){
+            compile(ast);
+            return;
+        }
+
+        // Lazy JIT: units are compiled once called, see addLazyUnits.
+        if (lazyJIT()){
+            for (auto unit : units){
+                auto function = declareUnit(*unit, GlobalEnv);
+                lazyUnitForms[function->getName()] = unit;
+                if (hasVectorSignature(function)){
+                    eagerUnits.insert(function->getName());
+                }
+            }
+            lazyUnits = std::move(units);
+            for (const auto& form : rest){
+                collectUnitRefs(form, mainCallees);
+            }
+            compile(AstContext::current().list(rest.data(), rest.size()));
+            return;
+        }
+
+        std::vector<std::future<llvm::orc::ThreadSafeModule>> results;
+        for (auto unit : units){
+            results.push_back(threadPool().submit([this, unit, &units](){
+                EvaLLVM unitCompiler(options, /* unit */ true);
+                unitCompiler.types = types;
+                return unitCompiler.compileUnit(*unit, units);
+            }));
+        }
+
+        for (auto unit : units){
+            declareUnit(*unit, GlobalEnv);
+        }
+        compile(AstContext::current().list(rest.data(), rest.size()));
+
+        for (auto& result : results){
+            unitModules.push_back(result.get());
+        }
+    }
+
+    /**
+     * Checks that the program compiles in order, as `compile` does: each
+     * function is defined once, and a unit is only called after its def
+     * (or from its own body). Units are declared up front once split out,
+     * so parallel and lazy builds would otherwise accept calls ahead of a
+     * def, and report duplicate defs only when linking.
+     */
+    void checkUnitOrder(const Exp& ast){
+        llvm::StringSet<> units;
+        for (const auto& form : ast.list()){
+            if (isUnitForm(form) && hasDefName(form)){
+                units.insert(form.list()[1].string());
+            }
+        }
+
+        llvm::StringSet<> defined;
+        for (const auto& form : ast.list()){
+            checkUnitOrder(form, units, defined);
+        }
+    }
+
+    void checkUnitOrder(const Exp& exp, const llvm::StringSet<>& units,
+                        llvm::StringSet<>& defined){
+        if (exp.type != ExpType::LIST || exp.list().empty()){
+            return;
+        }
+        const auto& tag = exp.list()[0];
+        if (isUnitForm(exp) && hasDefName(exp)){
+            auto name = exp.list()[1].string();
+            if (!defined.insert(name).second){
+                DIE << "Function \"" << name << "\" is already defined\n";
+            }
+        } else if (tag.type == ExpType::SYMBOL && units.count(tag.string()) &&
+                   !defined.count(tag.string())){
+            DIE << "Variable \"" << tag.string() << "\" is not defined.\n";
+        }
+        for (const auto& item : exp.list()){
+            checkUnitOrder(item, units, defined);
+        }
+    }
+
+    static bool hasDefName(const Exp& form){
+        return form.list().size() > 1 && form.list()[1].type == ExpType::SYMBOL;
+    }
+
+    /**
+     * In a unit compiler: generates and optimizes one unit form, and
+     * hands over the module with its context.
+     */
+    llvm::orc::ThreadSafeModule compileUnit(const Exp& form,
+                                            const std::vector<const Exp*>& units){
+        genUnit(form, units);
+        return llvm::orc::ThreadSafeModule(std::move(module), std::move(ctx));
+    }
+
+    /**
+     * In a unit compiler: generates and optimizes one unit form, and
+     * compiles it to an object with the compiler's own target machine.
+     */
+    std::unique_ptr<llvm::MemoryBuffer> compileUnitObject(
+            const Exp& form, const std::vector<const Exp*>& units){
+        genUnit(form, units);
+
+        llvm::SmallVector<char, 0> object;
+        compileObject(object);
+        return std::make_unique<llvm::SmallVectorMemoryBuffer>(
+            std::move(object), module->getName(), /* RequiresNullTerminator */ false);
+    }
+
+    /**
+     * Generates and optimizes one unit form, after declaring all units.
+     */
+    void genUnit(const Exp& form, const std::vector<const Exp*>& units){
+        for (auto unit : units){
+            declareUnit(*unit, GlobalEnv);
+        }
+        gen(form, GlobalEnv);
+        optimizeModule();
+    }
+
+    /**
+     * Whether a top-level form is compiled as a unit of its own.
+     */
+    bool isUnitForm(const Exp& exp) const {
+        if (exp.type != ExpType::LIST || exp.list().empty()){
+            return false;
+        }
+        const auto& tag = exp.list()[0];
+        return tag.type == ExpType::SYMBOL && tag.symbol->id < unitForms.size() &&
+               unitForms[tag.symbol->id] != nullptr;
+    }
+
+    llvm::Function* declareUnit(const Exp& form, Env env){
+        return (this->*unitForms[form.list()[0].symbol->id])(form, env);
+    }
+
+    /**
+     * Whether a function takes or returns vectors.
+     */
+    static bool hasVectorSignature(llvm::Function* function){
+        if (function->getReturnType()->isVectorTy()){
+            return true;
+        }
+        for (auto& arg : function->args()){
+            if (arg.getType()->isVectorTy()){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Whether units are compiled on first call: in JIT mode when the
+     * module is only run.
+     */
+    bool lazyJIT() const {
+        return options.jit && options.lazy && options.cacheDir.empty() &&
+               !options.dumpModule && options.objectFile.empty() &&
+               options.executableFile.empty();
+    }
+
+    /**
+     * Collects the names of the lazy units a form refers to.
+     */
+    void collectUnitRefs(const Exp& exp, std::vector<std::string>& names){
+        if (exp.type == ExpType::SYMBOL){
+            auto name = exp.string();
+            if (lazyUnitForms.count(llvm::StringRef(name.data(), name.size()))){
+                names.emplace_back(name);
+            }
+        } else if (exp.type == ExpType::LIST){
+            for (const auto& item : exp.list()){
+                collectUnitRefs(item, names);
+            }
+        }
+    }
+
+    /**
+     * Adds the lazy units to the JIT. Each unit is defined, uncompiled, in
+     * a JITDylib of its own, and the main JITDylib re-exports its function
+     * through a lazy call-through stub: the first call compiles the unit,
+     * later calls jump to it directly.
+     *
+     * Units link against the main JITDylib only, so their calls to other
+     * units go through the stubs too, and compile nothing ahead.
+     *
+     * Functions taking or returning vectors are re-exported without a
+     * stub instead, and compiled when a caller is linked: the call-through
+     * resolver only preserves the low 128 bits of vector registers.
+     */
+    void addLazyUnits(llvm::orc::LLJIT& jit,
+                      std::unique_ptr<llvm::orc::LazyCallThroughManager>& callThrough,
+                      std::unique_ptr<llvm::orc::IndirectStubsManager>& stubs){
+        auto& session = jit.getExecutionSession();
+        auto triple = jit.getTargetTriple();
+
+        auto manager = llvm::orc::createLocalLazyCallThroughManager(
+            triple, session, llvm::pointerToJITTargetAddress(&lazyCompileFailed));
+        if (!manager){
+            DIE << "Cannot create lazy call-through manager: "
+                << llvm::toString(manager.takeError()) << "\n";
+        }
+        callThrough = std::move(*manager);
+        stubs = llvm::orc::createLocalIndirectStubsManagerBuilder(triple)();
+
+        auto& mainDylib = jit.getMainJITDylib();
+        auto implDylib = jit.createJITDylib("<units>");
+        if (!implDylib){
+            DIE << "Cannot create units JITDylib: "
+                << llvm::toString(implDylib.takeError()) << "\n";
+        }
+        implDylib->setLinkOrder({{&mainDylib, llvm::orc::JITDylibLookupFlags::MatchAllSymbols}},
+                                /* LinkAgainstThisJITDylibFirst */ false);
+
+        llvm::orc::SymbolAliasMap reexports;
+        llvm::orc::SymbolAliasMap eagerReexports;
+        for (auto& entry : lazyUnitForms){
+            auto symbol = jit.mangleAndIntern(entry.first());
+            auto unit = std::make_unique<LazyUnit>(
+                entry.first().str(), symbol,
+                [this, &jit, name = entry.first().str()](
+                    std::unique_ptr<llvm::orc::MaterializationResponsibility> responsibility){
+                    jit.getObjLinkingLayer().emit(std::move(responsibility),
+                                                  takeUnitObject(name));
+                });
+            if (auto error = implDylib->define(std::move(unit))){
+                DIE << "Cannot define lazy unit: " << llvm::toString(std::move(error)) << "\n";
+            }
+            auto& aliases = eagerUnits.count(entry.first()) ? eagerReexports : reexports;
+            aliases[symbol] = {symbol, llvm::JITSymbolFlags::Exported |
+                                           llvm::JITSymbolFlags::Callable};
+        }
+
+        if (auto error = mainDylib.define(llvm::orc::lazyReexports(
+                *callThrough, *stubs, *implDylib, std::move(reexports)))){
+            DIE << "Cannot define lazy stubs: " << llvm::toString(std::move(error)) << "\n";
+        }
+        if (auto error = mainDylib.define(
+                llvm::orc::reexports(*implDylib, std::move(eagerReexports)))){
+            DIE << "Cannot define unit re-exports: " << llvm::toString(std::move(error)) << "\n";
+        }
+
+        if (options.speculate){
+            speculate(mainCallees);
+        }
+    }
+
+    /**
+     * Generates, optimizes and compiles a lazy unit to an object, in a
+     * unit compiler with its own context and target machine, so on any
+     * thread. With speculation, its callees are started next.
+     */
+    std::unique_ptr<llvm::MemoryBuffer> compileLazyUnit(const Exp& form){
+        if (options.speculate){
+            std::vector<std::string> callees;
+            collectUnitRefs(form, callees);
+            speculate(callees);
+        }
+
+        EvaLLVM unitCompiler(options, /* unit */ true);
+        unitCompiler.types = types;
+        return unitCompiler.compileUnitObject(form, lazyUnits);
+    }
+
+    /**
+     * Object of a lazy unit on its first call: the speculative one, once
+     * done, or compiled now on the calling thread.
+     *
+     * Only objects are compiled in the background: linking them into the
+     * JIT stays on the thread calling the unit.
+     */
+    std::unique_ptr<llvm::MemoryBuffer> takeUnitObject(const std::string& name){
+        std::future<std::unique_ptr<llvm::MemoryBuffer>> speculation;
+        {
+            std::lock_guard<std::mutex> lock(speculationMutex);
+            auto started = speculations.find(name);
+            if (started != speculations.end()){
+                speculation = std::move(started->second);
+                speculations.erase(started);
+            } else {
+                speculated.insert(name);
+            }
+        }
+
+        if (speculation.valid()){
+            return speculation.get();
+        }
+        return compileLazyUnit(*lazyUnitForms.lookup(name));
+    }
+
+    /**
+     * Starts compiling the named units on the thread pool, unless already
+     * started.
+     */
+    void speculate(const std::vector<std::string>& names){
+        std::lock_guard<std::mutex> lock(speculationMutex);
+        for (const auto& name : names){
+            if (!speculated.insert(name).second){
+                continue;
+            }
+            auto form = lazyUnitForms.lookup(name);
+            speculations[name] = threadPool().submit(
+                [this, form](){ return compileLazyUnit(*form); });
+        }
+    }
+
+    /**
+     * Waits for the speculative compilations of units never called,
+     * including the ones they start, as they use the program's AST.
+     */
+    void waitSpeculations(){
+        for (;;){
+            std::future<std::unique_ptr<llvm::MemoryBuffer>> speculation;
+            {
+                std::lock_guard<std::mutex> lock(speculationMutex);
+                if (speculations.empty()){
+                    break;
+                }
+                speculation = std::move(speculations.begin()->second);
+                speculations.erase(speculations.begin());
+            }
+            speculation.get();
+        }
+    }
+
+    /**
+     * Called by a lazy stub whose unit failed to compile.
+     */
+    static void lazyCompileFailed(){
+        DIE << "Lazy compilation of a function failed\n";
+    }
+
+    /**
+     * Links the unit modules into the module. Modules of different
+     * contexts cannot be linked directly, so each unit goes through
+     * bitcode into the module's context.
+     */
+    void linkUnits(){
+        for (auto& unit : unitModules){
+            llvm::SmallVector<char, 0> bitcode;
+            unit.withModuleDo([&](llvm::Module& unitModule){
+                llvm::raw_svector_ostream out(bitcode);
+                llvm::WriteBitcodeToFile(unitModule, out);
+            });
+
+            auto linked = llvm::parseBitcodeFile(
+                llvm::MemoryBufferRef(llvm::StringRef(bitcode.data(), bitcode.size()),
+                                      "unit"),
+                *ctx);
+            if (!linked){
+                DIE << "Cannot read unit module: " << llvm::toString(linked.takeError()) << "\n";
+            }
+            if (llvm::Linker::linkModules(*module, std::move(*linked))){
+                DIE << "Cannot link unit module\n";
+            }
+        }
+        unitModules.clear();
+    }
+
+    /**
+     * Creates `main` and positions the builder in its entry block.
+     */
+    void beginMain(){
         fn = createFunction("main", llvm::FunctionType::get(/* return type */ builder->getInt32Ty(),/* vararg */ false), GlobalEnv);
         
         createGlobalVar("VERSION", builder->getInt32(42));
+    }
 
-        // 2. compile main body
-        auto result = gen(ast, GlobalEnv);
-
-        // 3. cast to i32 to return from main
+    /**
+     * Terminates `main`.
+     */
+    void endMain(){
+        // cast to i32 to return from main
         // auto i32Result =
         //     builder->CreateIntCast(result, builder->getInt32Ty(), true);
 
-        // 4. return
+        // return
         // builder->CreateRet(i32Result);
-        // 4. just return zero
+        // just return zero
         builder->CreateRet(builder->getInt32(0));
     }
-    /* main compile loop */
 
-    llvm::Value* gen(const Exp& exp, Env env){ 
-        switch (exp.type) {
-            /*
-            * Number
-            // ------------------------------------------
-            */
-            case ExpType::NUMBER:
-                return builder->getInt32(exp.number);
-            /*
-            * String
-            // ------------------------------------------
-            */
-            case ExpType::STRING:{
-                auto re = std::regex("\\\\n");
-                auto str = std::regex_replace(exp.string, re, "\n");
-                return builder->CreateGlobalStringPtr(str);
+    /**
+     * Reads the input in chunks, and calls `fn` with the AST of each
+     * top-level form as soon as the form is complete. The ASTs share one
+     * context, reset when `fn` returns, so each form reuses the memory of
+     * the previous one.
+     *
+     * Syntax errors are reported at their location in the input, not in
+     * the form.
+     */
+    template <typename Fn>
+    void forEachForm(std::istream& input, Fn&& fn){
+        static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+        std::string buffer;
+        syntax::FormScanner scanner;
+        syntax::FormRange form;
+
+        // End of the last compiled form in the buffer.
+        size_t consumed = 0;
+        auto eof = false;
+
+        // Location in the input of the offset `located` of the buffer.
+        syntax::Location location{1, 0};
+        size_t located = 0;
+
+        AstContext astContext;
+        AstContext::Scope astScope(astContext);
+
+        for (;;){
+            if (scanner.next(buffer, eof, form)){
+                location = syntax::Tokenizer::advance(
+                    location, std::string_view(buffer).substr(located, form.start - located));
+                located = form.start;
+
+                auto source = std::string_view(buffer).substr(
+                    form.start, form.end - form.start);
+                fn(parser->parse(source, location));
+                astContext.reset();
+
+                consumed = form.end;
+                continue;
             }
-            /*
-            * Symbol(variables, operators)
+
+            if (eof){
+                break;
+            }
+
+            // Drop compiled forms, and read the next chunk.
+            location = syntax::Tokenizer::advance(
+                location, std::string_view(buffer).substr(located, consumed - located));
+            located = 0;
+            buffer.erase(0, consumed);
+            scanner.consume(consumed);
+            consumed = 0;
+
+            auto size = buffer.size();
+            buffer.resize(size + CHUNK_SIZE);
+            input.read(&buffer[size], CHUNK_SIZE);
+            buffer.resize(size + input.gcount());
+            eof = !input;
+        }
+    }
+
+    /**
+     * Moves a seekable stream back to `position`, for another pass.
+     */
+    static void rewind(std::istream& input, std::istream::pos_type position){
+        input.clear();
+        if (!input.seekg(position)){
+            DIE << "Cannot read the program again\n";
+        }
+    }
+
+    /**
+     * Programs smaller than this are parsed on the calling thread.
+     */
+    static constexpr size_t PARALLEL_PARSE_MIN_SIZE = 1024 * 1024;
+
+    /**
+     * Size of the rest of a seekable stream (a file), 0 for others (a
+     * pipe).
+     */
+    static size_t remainingSize(std::istream& input){
+        auto start = input.tellg();
+        if (start == std::istream::pos_type(-1) || !input.seekg(0, std::ios::end)){
+            input.clear();
+            return 0;
+        }
+        auto end = input.tellg();
+        input.seekg(start);
+        return end == std::istream::pos_type(-1) ? 0 : static_cast<size_t>(end - start);
+    }
+
+    /**
+     * Parses a program as (begin <program>) on the thread pool.
+     *
+     * A structural pre-scan splits the program into top-level forms,
+     * which are grouped into chunks of similar size. Each chunk is parsed
+     * by its own parser into its own AstContext (kept alive in
+     * `chunkContexts`), and the forms are merged in order into the
+     * `begin` list built in `astContext`.
+     */
+    Exp parseParallel(std::string_view program, AstContext& astContext,
+                      std::vector<std::unique_ptr<AstContext>>& chunkContexts){
+        auto forms = syntax::FormScanner::split(program);
+
+        // Group forms into a few chunks per thread, balanced by size.
+        auto& pool = threadPool();
+        auto chunksCount = pool.size() * 4;
+        auto chunkSize = program.size() / chunksCount + 1;
+
+        std::vector<std::pair<size_t, size_t>> chunks;
+        for (size_t first = 0, i = 0; i < forms.size(); i++){
+            if (forms[i].end - forms[first].start >= chunkSize ||
+                i + 1 == forms.size()){
+                chunks.emplace_back(first, i + 1);
+                first = i + 1;
+            }
+        }
+
+        std::vector<std::future<std::vector<Exp>>> results;
+        syntax::Location chunkLocation{1, 0};
+        size_t chunkStart = 0;
+        for (auto& chunk : chunks){
+            chunkContexts.push_back(std::make_unique<AstContext>());
+            auto chunkContext = chunkContexts.back().get();
+
+            // Syntax errors are located in the program, from the start
+            // of the chunk.
+            chunkLocation = syntax::Tokenizer::advance(
+                chunkLocation, program.substr(chunkStart, forms[chunk.first].start - chunkStart));
+            chunkStart = forms[chunk.first].start;
+
+            results.push_back(pool.submit([&forms, program, chunk, chunkContext,
+                                           location = chunkLocation,
+                                           located = chunkStart]() mutable {
+                EvaParser chunkParser;
+                AstContext::Scope astScope(*chunkContext);
+
+                std::vector<Exp> asts;
+                for (auto i = chunk.first; i < chunk.second; i++){
+                    location = syntax::Tokenizer::advance(
+                        location, program.substr(located, forms[i].start - located));
+                    located = forms[i].start;
+                    asts.push_back(chunkParser.parse(
+                        program.substr(forms[i].start, forms[i].end - forms[i].start),
+                        location));
+                }
+                return asts;
+            }));
+        }
+
+        // Merge: (begin <forms in source order>)
+        std::vector<Exp> items{astContext.symbol("begin")};
+        items.reserve(forms.size() + 1);
+        for (auto& result : results){
+            for (auto& form : result.get()){
+                items.push_back(form);
+            }
+        }
+        return astContext.list(items.data(), items.size());
+    }
+
+    /**
+     * Worker threads, created on first use.
+     */
+    ThreadPool& threadPool(){
+        if (pool == nullptr){
+            pool = std::make_unique<ThreadPool>(
+                std::max(options.parseThreads, options.codegenThreads));
+        }
+        return *pool;
+    }
+
+    /**
+     * Runs the compiled module in JIT mode, outputs it otherwise.
+     */
+    int finish(){
+        auto cacheKey = std::move(cacheKey_);
+        cacheKey_.clear();
+
+        // A module loaded from the cache is already optimized, and so are
+        // unit modules, by their own compilers.
+        if (!moduleFromCache_){
+            optimizeModule();
+        }
+
+        // Unit modules are linked into the module, unless it only goes to
+        // the JIT, which takes them as separate units.
+        auto separateUnits = options.jit && cacheKey.empty() && !options.dumpModule &&
+                             options.objectFile.empty() && options.executableFile.empty();
+        if (!separateUnits){
+            linkUnits();
+        }
+
+        if (!moduleFromCache_ && !cacheKey.empty()){
+            storeCachedModule(cacheKey);
+        }
+        moduleFromCache_ = false;
+
+        emitNative(cacheKey);
+
+        if (options.dumpModule){
+            module->print(llvm::outs(), nullptr);
+            llvm::outs() << "\n";
+            llvm::outs().flush();
+        }
+
+        if (options.jit){
+            return runJIT();
+        }
+        outputModule();
+        return 0;
+    }
+
+    /**
+     * Runs the default optimization pipeline of `options.optLevel` on the
+     * module: at O1+ mem2reg/SROA turn the stack variables into SSA
+     * values, instcombine and GVN clean up, and at O2+ the loop and SLP
+     * vectorizers run.
+     */
+    void optimizeModule(){
+        optimizationTime_ = {};
+        if (options.optLevel == 0){
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        static const llvm::OptimizationLevel levels[] = {
+            llvm::OptimizationLevel::O0, llvm::OptimizationLevel::O1,
+            llvm::OptimizationLevel::O2, llvm::OptimizationLevel::O3,
+        };
+        auto level = levels[std::min(options.optLevel, 3u)];
+
+        llvm::PipelineTuningOptions tuning;
+        tuning.LoopVectorization = options.optLevel >= 2;
+        tuning.SLPVectorization = options.optLevel >= 2;
+
+        llvm::LoopAnalysisManager loopAM;
+        llvm::FunctionAnalysisManager functionAM;
+        llvm::CGSCCAnalysisManager cgsccAM;
+        llvm::ModuleAnalysisManager moduleAM;
+
+        llvm::PassBuilder passBuilder(targetMachine.get(), tuning);
+        passBuilder.registerModuleAnalyses(moduleAM);
+        passBuilder.registerCGSCCAnalyses(cgsccAM);
+        passBuilder.registerFunctionAnalyses(functionAM);
+        passBuilder.registerLoopAnalyses(loopAM);
+        passBuilder.crossRegisterProxies(loopAM, functionAM, cgsccAM, moduleAM);
+
+        auto modulePM = passBuilder.buildPerModuleDefaultPipeline(level);
+        modulePM.run(*module, moduleAM);
+
+        optimizationTime_ = std::chrono::steady_clock::now() - start;
+    }
+
+    /**
+     * Version of the generated code, for the cache key: bump it with any
+     * change to the code generated for the same program.
+     */
+    static constexpr const char* CODEGEN_VERSION = "4";
+
+    /**
+     * Options that change the compiled code, for the cache key.
+     */
+    std::string cacheOptions(){
+        // Units are optimized apart from `main`, so they change the code.
+        return "O" + std::to_string(options.optLevel) + ";" +
+               (options.codegenThreads > 1 ? "units;" : "") +
+               targetMachine->getTargetTriple().str() + ";" +
+               targetMachine->getTargetCPU().str() + ";" +
+               targetMachine->getTargetFeatureString().str();
+    }
+
+    /**
+     * Replaces the module with the cached optimized bitcode for
+     * `cacheKey_`. Returns false on a miss.
+     */
+    bool loadCachedModule(){
+        auto bitcode = cache->lookup(cacheKey_, ".bc");
+        if (bitcode == nullptr){
+            return false;
+        }
+
+        auto cached = llvm::parseBitcodeFile(bitcode->getMemBufferRef(), *ctx);
+        if (!cached){
+            // A corrupt entry is a miss, overwritten by this compile.
+            llvm::consumeError(cached.takeError());
+            return false;
+        }
+
+        module = std::move(*cached);
+        moduleFromCache_ = true;
+        return true;
+    }
+
+    /**
+     * Caches the optimized module as bitcode.
+     */
+    void storeCachedModule(const std::string& cacheKey){
+        llvm::SmallVector<char, 0> bitcode;
+        llvm::raw_svector_ostream out(bitcode);
+        llvm::WriteBitcodeToFile(*module, out);
+        cache->store(cacheKey, ".bc", llvm::StringRef(bitcode.data(), bitcode.size()));
+    }
+
+    /**
+     * Emits the object file and links the executable, if requested.
+     */
+    void emitNative(const std::string& cacheKey){
+        if (options.objectFile.empty() && options.executableFile.empty()){
+            return;
+        }
+
+        // Without an object file path, link from a temporary one.
+        auto objectFile = options.objectFile.empty()
+                              ? options.executableFile + ".o"
+                              : options.objectFile;
+
+        emitObject(objectFile, cacheKey);
+
+        if (!options.executableFile.empty()){
+            linkExecutable(objectFile, options.executableFile);
+            if (options.objectFile.empty()){
+                llvm::sys::fs::remove(objectFile);
+            }
+        }
+    }
+
+    /**
+     * Compiles the module to a relocatable object file for the host, or
+     * copies it from the cache.
+     */
+    void emitObject(const std::string& fileName, const std::string& cacheKey){
+        llvm::SmallVector<char, 0> object;
+
+        auto cached = cacheKey.empty() ? nullptr : cache->lookup(cacheKey, ".o");
+        if (cached != nullptr){
+            object.assign(cached->getBufferStart(), cached->getBufferEnd());
+        } else {
+            compileObject(object);
+
+            if (!cacheKey.empty()){
+                cache->store(cacheKey, ".o", llvm::StringRef(object.data(), object.size()));
+            }
+        }
+
+        std::error_code errorCode;
+        llvm::raw_fd_ostream out(fileName, errorCode, llvm::sys::fs::OF_None);
+        if (errorCode){
+            DIE << "Cannot open " << fileName << ": " << errorCode.message() << "\n";
+        }
+        out.write(object.data(), object.size());
+    }
+
+    /**
+     * Compiles the module to a relocatable object for the host.
+     */
+    void compileObject(llvm::SmallVectorImpl<char>& object){
+        llvm::raw_svector_ostream objectOut(object);
+        llvm::legacy::PassManager codegenPM;
+        if (targetMachine->addPassesToEmitFile(codegenPM, objectOut, nullptr,
+                                               llvm::CGFT_ObjectFile)){
+            DIE << "Host target cannot emit object files\n";
+        }
+        codegenPM.run(*module);
+    }
+
+    /**
+     * Links an object file into an executable with the system C compiler
+     * driver, which adds the C runtime and libc (printf).
+     */
+    void linkExecutable(const std::string& objectFile, const std::string& fileName){
+        auto driver = llvm::sys::findProgramByName("cc");
+        if (!driver){
+            DIE << "Cannot find cc to link " << fileName << "\n";
+        }
+
+        llvm::StringRef args[] = {*driver, objectFile, "-o", fileName};
+        std::string error;
+        auto status = llvm::sys::ExecuteAndWait(*driver, args, llvm::None, {},
+                                                0, 0, &error);
+        if (status != 0){
+            DIE << "Linking " << fileName << " failed: " << error << "\n";
+        }
+    }
+
+    /**
+     * Hands the module and its context over to an ORC LLJIT instance,
+     * and calls `main` in this process. External functions (printf)
+     * resolve to the host process symbols.
+     *
+     * A fresh module is opened afterwards, so the compiler stays usable.
+     */
+    int runJIT(){
+        auto jit = createJIT();
+
+        // Lazy stubs. They hold symbols of the JIT's string pool, so they
+        // are destroyed before the JIT.
+        std::unique_ptr<llvm::orc::LazyCallThroughManager> callThrough;
+        std::unique_ptr<llvm::orc::IndirectStubsManager> stubs;
+
+        if (auto error = jit->addIRModule(
+                llvm::orc::ThreadSafeModule(std::move(module), std::move(ctx)))){
+            DIE << "Cannot add module to JIT: " << llvm::toString(std::move(error)) << "\n";
+        }
+        for (auto& unit : unitModules){
+            if (auto error = jit->addIRModule(std::move(unit))){
+                DIE << "Cannot add unit module to JIT: "
+                    << llvm::toString(std::move(error)) << "\n";
+            }
+        }
+        unitModules.clear();
+
+        if (!lazyUnits.empty()){
+            addLazyUnits(*jit, callThrough, stubs);
+        }
+
+        auto mainSymbol = jit->lookup("main");
+        if (!mainSymbol){
+            DIE << "Cannot find main: " << llvm::toString(mainSymbol.takeError()) << "\n";
+        }
+
+        auto mainFn = reinterpret_cast<int (*)()>(mainSymbol->getAddress());
+        auto exitCode = mainFn();
+
+        waitSpeculations();
+        speculated.clear();
+        lazyUnits.clear();
+        lazyUnitForms.clear();
+        mainCallees.clear();
+
+        moduleInit();
+        setupExternalFunctions();
+        setupGlobalEnvironment();
+
+        return exitCode;
+    }
+
+    /**
+     * Creates an ORC LLJIT instance in which external functions (printf)
+     * resolve to the host process symbols.
+     */
+    std::unique_ptr<llvm::orc::LLJIT> createJIT(){
+        auto jit = llvm::orc::LLJITBuilder().create();
+        if (!jit){
+            DIE << "Cannot create JIT: " << llvm::toString(jit.takeError()) << "\n";
+        }
+
+        auto hostSymbols = llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+            (*jit)->getDataLayout().getGlobalPrefix());
+        if (!hostSymbols){
+            DIE << "Cannot load host symbols: "
+                << llvm::toString(hostSymbols.takeError()) << "\n";
+        }
+        (*jit)->getMainJITDylib().addGenerator(std::move(*hostSymbols));
+
+        return std::move(*jit);
+    }
+
+    /**
+     * Opens the module of the next session input, with its code in a
+     * function of its own.
+     *
+     * The session starts on the first input, adding the module opened by
+     * the constructor (which defines the builtin globals) to a new JIT;
+     * its context is shared by all inputs, so the types of earlier
+     * globals stay valid. Each input gets a fresh module and global
+     * environment, in which the globals of earlier inputs are declared.
+     */
+    void beginInput(){
+        if (session == nullptr){
+            session = createJIT();
+            sessionStubs = llvm::orc::createLocalIndirectStubsManagerBuilder(
+                targetMachine->getTargetTriple())();
+            sessionContext = llvm::orc::ThreadSafeContext(std::move(ctx));
+            for (auto& global : module->globals()){
+                if (!global.isDeclaration() && global.hasExternalLinkage()){
+                    sessionGlobals[global.getName().str()] = {global.getName().str(),
+                                                              global.getValueType()};
+                    sessionSymbols.insert(global.getName());
+                }
+            }
+            if (auto error = session->addIRModule(
+                    llvm::orc::ThreadSafeModule(std::move(module), sessionContext))){
+                DIE << "Cannot add builtins to JIT: " << llvm::toString(std::move(error))
+                    << "\n";
+            }
+        }
+
+        module = std::make_unique<llvm::Module>("EvaLLVM", *sessionContext.getContext());
+        module->setTargetTriple(targetMachine->getTargetTriple().str());
+        module->setDataLayout(targetMachine->createDataLayout());
+        stringLiterals.clear();
+        arrayScopes.clear();
+        heapArrays.clear();
+        arrayOwners.clear();
+        setupExternalFunctions();
+        declareSessionGlobals();
+
+        fn = createFunction("input." + std::to_string(sessionInputs++),
+                            llvm::FunctionType::get(builder->getInt32Ty(), /* vararg */ false),
+                            GlobalEnv);
+    }
+
+    /**
+     * Creates a new global environment with the globals of earlier
+     * session inputs, declared in the module.
+     */
+    void declareSessionGlobals(){
+        GlobalEnv = std::make_shared<Environment>(
+            std::map<std::string, llvm::Value*>{}, nullptr);
+
+        for (auto& entry : sessionGlobals){
+            auto& global = entry.second;
+            if (auto fnType = llvm::dyn_cast<llvm::FunctionType>(global.type)){
+                auto function = llvm::cast<llvm::Function>(
+                    module->getOrInsertFunction(global.symbol, fnType).getCallee());
+                function->setCallingConv(global.callingConv);
+                GlobalEnv->define(entry.first, function);
+            } else {
+                GlobalEnv->define(entry.first, declareGlobalVar(global.symbol, global.type));
+            }
+        }
+    }
+
+    /**
+     * Defines a top-level variable of a session input as a global. A
+     * variable defined again with the same type keeps its global, with
+     * another type it gets a new one under a fresh symbol.
+     */
+    llvm::Value* sessionVar(const std::string& name, llvm::Type* type){
+        auto known = sessionGlobals.find(name);
+        if (known != sessionGlobals.end() && known->second.type == type){
+            return GlobalEnv->lookup(name);
+        }
+
+        auto variable = createGlobalVar(sessionSymbol(name), llvm::Constant::getNullValue(type));
+        GlobalEnv->define(name, variable);
+        sessionGlobals[name] = {variable->getName().str(), type};
+        return variable;
+    }
+
+    /**
+     * Declares a top-level def of a session input. A def defined again
+     * with the same type keeps its symbol, and replaces the earlier code
+     * when the input is added; with another type it gets a new symbol,
+     * and earlier callers keep the earlier def.
+     */
+    llvm::Function* sessionDef(const std::string& name, llvm::FunctionType* fnType){
+        auto known = sessionGlobals.find(name);
+        if (known != sessionGlobals.end() && known->second.type == fnType){
+            return module->getFunction(known->second.symbol);
+        }
+
+        auto function = llvm::Function::Create(fnType, llvm::Function::ExternalLinkage,
+                                               sessionSymbol(name), *module);
+        function->setCallingConv(llvm::CallingConv::Fast);
+        GlobalEnv->define(name, function);
+        sessionGlobals[name] = {function->getName().str(), fnType, function->getCallingConv()};
+        return function;
+    }
+
+    /**
+     * A symbol for a new session global: its name, or a fresh one if the
+     * name is taken.
+     */
+    std::string sessionSymbol(const std::string& name){
+        auto symbol = name;
+        if (sessionSymbols.count(symbol)){
+            symbol += "." + std::to_string(sessionSymbols.size());
+        }
+        sessionSymbols.insert(symbol);
+        return symbol;
+    }
+
+    /**
+     * Adds the module of the session input to the session's JIT, and
+     * returns the address of its code. Functions it defines are kept for
+     * later inputs.
+     *
+     * Each function goes to a module of its own, with its own resource
+     * tracker, and is called through a stub under its symbol: a def
+     * defined again updates its stub, then its earlier code is removed.
+     * If the input does not link, its modules are removed and the stubs
+     * keep their earlier code.
+     */
+    llvm::JITTargetAddress addInput(){
+        auto& dylib = session->getMainJITDylib();
+        std::vector<std::pair<std::string, llvm::orc::ResourceTrackerSP>> defs;
+        auto inputTracker = dylib.createResourceTracker();
+
+        auto discard = [&](const std::string& message, llvm::Error error){
+            for (auto& def : defs){
+                llvm::consumeError(def.second->remove());
+            }
+            llvm::consumeError(inputTracker->remove());
+            DIE << message << ": " << llvm::toString(std::move(error)) << "\n";
+        };
+
+        // 1. Split the functions of the input into modules of their own
+        std::vector<llvm::Function*> functions;
+        for (auto& function : module->functions()){
+            if (!function.isDeclaration() && &function != fn){
+                functions.push_back(&function);
+            }
+        }
+
+        std::vector<llvm::orc::ThreadSafeModule> defModules;
+        for (auto function : functions){
+            auto symbol = function->getName().str();
+            if (!sessionSymbols.count(symbol)){
+                sessionGlobals[symbol] = {symbol, function->getFunctionType(),
+                                          function->getCallingConv()};
+                sessionSymbols.insert(symbol);
+            }
+            auto implName = symbol + ".impl" + std::to_string(sessionInputs);
+            function->setName(implName);
+
+            // Other code calls the stub, recursion stays direct.
+            auto stub = llvm::Function::Create(function->getFunctionType(),
+                                               llvm::Function::ExternalLinkage, symbol, *module);
+            stub->setCallingConv(function->getCallingConv());
+            function->replaceUsesWithIf(stub, [function](llvm::Use& use){
+                auto user = llvm::dyn_cast<llvm::Instruction>(use.getUser());
+                return user == nullptr || user->getFunction() != function;
+            });
+            defs.push_back({symbol, dylib.createResourceTracker()});
+        }
+        for (auto function : functions){
+            llvm::ValueToValueMapTy values;
+            defModules.emplace_back(
+                llvm::CloneModule(*module, values,
+                                  [function](const llvm::GlobalValue* global){
+                                      return global == function || global->hasLocalLinkage();
+                                  }),
+                sessionContext);
+        }
+        for (auto function : functions){
+            function->eraseFromParent();
+        }
+
+        // 2. Create the stubs of new symbols
+        for (auto& def : defs){
+            if (sessionStubs->findStub(def.first, /* exportedStubsOnly */ false)){
+                continue;
+            }
+            auto flags = llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable;
+            if (auto error = sessionStubs->createStub(def.first, 0, flags)){
+                discard("Cannot create stub of " + def.first, std::move(error));
+            }
+            auto stub = sessionStubs->findStub(def.first, /* exportedStubsOnly */ false);
+            if (auto error = dylib.define(llvm::orc::absoluteSymbols(
+                    {{session->mangleAndIntern(def.first), stub}}))){
+                discard("Cannot define stub of " + def.first, std::move(error));
+            }
+        }
+
+        // 3. Link the functions and the input
+        for (size_t i = 0; i < defs.size(); i++){
+            if (auto error = session->addIRModule(defs[i].second, std::move(defModules[i]))){
+                discard("Cannot add " + defs[i].first + " to JIT", std::move(error));
+            }
+        }
+        auto inputName = fn->getName().str();
+        if (auto error = session->addIRModule(
+                inputTracker, llvm::orc::ThreadSafeModule(std::move(module), sessionContext))){
+            discard("Cannot add input to JIT", std::move(error));
+        }
+
+        std::vector<llvm::JITTargetAddress> addresses;
+        for (auto& def : defs){
+            auto impl = session->lookup(def.first + ".impl" + std::to_string(sessionInputs));
+            if (!impl){
+                discard("Cannot link " + def.first, impl.takeError());
+            }
+            addresses.push_back(impl->getAddress());
+        }
+        auto inputSymbol = session->lookup(inputName);
+        if (!inputSymbol){
+            discard("Cannot link " + inputName, inputSymbol.takeError());
+        }
+
+        // 4. Point the stubs to the new code, and drop the code replaced
+        for (size_t i = 0; i < defs.size(); i++){
+            if (auto error = sessionStubs->updatePointer(defs[i].first, addresses[i])){
+                discard("Cannot update stub of " + defs[i].first, std::move(error));
+            }
+            auto replaced = sessionDefs.find(defs[i].first);
+            if (replaced != sessionDefs.end()){
+                llvm::consumeError(replaced->second->remove());
+            }
+            sessionDefs[defs[i].first] = defs[i].second;
+        }
+
+        return inputSymbol->getAddress();
+    }
+
+    /**
+     * Writes the module in the output format to the output stream, or
+     * saves it to the output file.
+     */
+    void outputModule(){
+        if (options.outputFormat == OutputFormat::None){
+            return;
+        }
+
+        if (options.outputStream != nullptr){
+            writeModule(*options.outputStream);
+            return;
+        }
+
+        auto fileName = options.outputFile;
+        if (fileName.empty()){
+            fileName = options.outputFormat == OutputFormat::Bitcode ? "./out.bc"
+                                                                     : "./out.ll";
+        }
+        saveModuleToFile(fileName);
+    }
+
+    /**
+     * Writes the module in the output format.
+     */
+    void writeModule(llvm::raw_ostream& out){
+        if (options.outputFormat == OutputFormat::Bitcode){
+            llvm::WriteBitcodeToFile(*module, out);
+        } else {
+            module->print(out, nullptr);
+        }
+    }
+
+    /* main compile loop */
+
+    llvm::Value* gen(const Exp& exp, Env env){ 
+        switch (exp.type) {
+            /*
+            * Number
             // ------------------------------------------
             */
-            case ExpType::SYMBOL:
-                // return builder->getInt32(0);
+            case ExpType::NUMBER:
+                return integerConstant(exp.number);
+            /*
+            * Decimal
+            // ------------------------------------------
+            */
+            case ExpType::DECIMAL:
+                return llvm::ConstantFP::get(builder->getDoubleTy(), exp.decimal);
+            /*
+            * String
+            // ------------------------------------------
+            */
+            case ExpType::STRING:
+                return stringLiteral(exp.string());
+            /*
+            * Symbol(variables, operators)
+            // ------------------------------------------
+            */
+            case ExpType::SYMBOL: {
                 /**
                  * Boolean
                  */
-                if (exp.string == "true" || exp.string == "false"){
-                    return builder->getInt1(exp.string == "true" ? true : false);
-                } else {
-                    // Variable
-                    auto varName = exp.string; 
-                    auto value = env->lookup(varName);
-
-                    // 1. Local Vars:
-                    if (auto localVar = llvm::dyn_cast<llvm::AllocaInst>(value)){
-                        return builder->CreateLoad(localVar->getAllocatedType(), localVar,
-                                                    varName.c_str());
-                    }
+                if (exp.isSymbol(trueSymbol) || exp.isSymbol(falseSymbol)){
+                    return builder->getInt1(exp.isSymbol(trueSymbol));
+                }
+
+                // Variable
+                auto varName = std::string(exp.string());
+                auto value = lookupVar(varName, env);
+
+                // 1. Local Vars:
+                if (auto localVar = llvm::dyn_cast<llvm::AllocaInst>(value)){
+                    return builder->CreateLoad(localVar->getAllocatedType(), localVar,
+                                                varName.c_str());
+                }
+
+                // 2. Global vars:
+                else if(auto globalVar = llvm::dyn_cast<llvm::GlobalVariable>(value)) {
+                    return builder->CreateLoad(globalVar->getValueType(), 
+                                                globalVar, varName.c_str());
+                }
+
+                // 3. Functions:
+                return value;
+            }
+            /*
+            * Lists
+            // ------------------------------------------
+            */
+            case ExpType::LIST: {
+                if (exp.list().empty()){
+                    DIE << "Cannot evaluate an empty list ()\n";
+                }
+                const auto& tag = exp.list()[0];
+
+                /*
+                * Special forms, dispatched by the interned id of the tag.
+                // ------------------------------------------
+                */
+                if (tag.type == ExpType::SYMBOL &&
+                    tag.symbol->id < specialForms.size() &&
+                    specialForms[tag.symbol->id] != nullptr){
+                    return (this->*specialForms[tag.symbol->id])(exp, env);
+                }
+
+                /*
+                * Function calls: (square 2)
+                // ------------------------------------------
+                */
+                return genCall(exp, env);
+            }
+        }
+
+        // just 42
+        //return builder->getInt32(42);
+
+        // string:
+        // return builder->CreateGlobalStringPtr("Hello World!\n");
+        // auto str = builder->CreateGlobalStringPtr("Hello World!\n");
+
+        // // call to printf
+        // auto printfFn = module->getFunction("printf");
+
+        // // args
+        // std::vector<llvm::Value*> args{str};
+
+        // return builder->CreateCall(printfFn, args);
+
+        //Unreachable
+        return builder->getInt32(0);
+    }
+
+    /**
+     * Pointer to a string literal (escapes already decoded by the parser).
+     * Equal literals share one private constant global.
+     */
+    llvm::Constant* stringLiteral(std::string_view text){
+        auto& literal = stringLiterals[llvm::StringRef(text.data(), text.size())];
+        if (literal == nullptr){
+            literal = builder->CreateGlobalStringPtr(
+                llvm::StringRef(text.data(), text.size()));
+        }
+        return literal;
+    }
+
+    // ------------------------------------------
+    // Variable declaration: (var x (+ y 10))
+    // 
+    // Typed: (var (x number) 42), (var (x i64) 42), (var (x f64) 0.5)
+    //
+    // Arrays: (var (a (array 100 f64)) 0) allocates 100 elements set to
+    // 0, (var (b (array f64)) a) refers to an existing array. An array
+    // lives until the end of the block it is declared in.
+    //
+    // Note: locals are allocated on the stack.
+
+    llvm::Value* genVar(const Exp& exp, Env env){
+        if (exp.list().size() != 3 || !isVarDecl(exp.list()[1])){
+            DIE << "var expects a name, or (name type), and a value\n";
+        }
+        const auto& varNameDecl = exp.list()[1];
+        auto varName = extractVarName(varNameDecl);
+
+        // Initializer:
+        auto init = gen(exp.list()[2], env);
+
+        // Type: annotated, or inferred from all the values assigned.
+        auto varTy = inferredType(exp, varNameDecl.type == ExpType::LIST
+                                           ? extractVarType(varNameDecl)
+                                           : init->getType());
+        if (arrayElementType(varTy) != nullptr){
+            init = genArray(varNameDecl.list()[1], init, env);
+        }
+        init = convert(init, varTy);
+
+        // Variable: a global at the top level of a session input, so that
+        // later inputs see it.
+        auto varBinding = session != nullptr && env == GlobalEnv
+                              ? sessionVar(varName, varTy)
+                              : allocVar(varName, varTy, env);
+
+        // Set value:
+        return builder->CreateStore(init, varBinding);
+    }
+
+    /**
+     * Looks up a variable, function or global. A def sees its own locals
+     * and the globals only: the stack of an enclosing function (main's
+     * included) is not its own.
+     */
+    llvm::Value* lookupVar(const std::string& name, Env env){
+        auto value = env->lookup(name);
+        auto local = llvm::dyn_cast<llvm::Instruction>(value);
+        if (local != nullptr && local->getFunction() != fn){
+            DIE << "\"" << name << "\" is a local variable of an enclosing function: "
+                << "a def can only use its parameters, its own variables and globals\n";
+        }
+        return value;
+    }
+
+    // ------------------------------------------
+    // Variable update: (set x 100)
+
+    llvm::Value* genSet(const Exp& exp, Env env){
+        if (exp.list().size() != 3 || exp.list()[1].type != ExpType::SYMBOL){
+            DIE << "set expects a variable name and a value\n";
+        }
+
+        // Value:
+        auto value = gen(exp.list()[2], env);
+
+        auto varName = std::string(exp.list()[1].string());
+
+        // Variable:
+        auto varBinding = lookupVar(varName, env);
+        if (!llvm::isa<llvm::AllocaInst>(varBinding) &&
+            !llvm::isa<llvm::GlobalVariable>(varBinding)){
+            DIE << "Cannot set \"" << varName << "\", it is not a variable\n";
+        }
+
+        // An array must not outlive the block it is allocated in.
+        if (arrayElementType(value->getType()) != nullptr){
+            for (auto scope = env; !scope->defines(varName); scope = scope->parent()){
+                if (arrayOwners.count(scope.get()) != 0){
+                    DIE << "Cannot set \"" << varName << "\" to an array: arrays of "
+                        << "the blocks it is declared outside of are freed at their end\n";
+                }
+            }
+        }
+
+        // Set value, converted to the variable's type:
+        auto varTy = llvm::isa<llvm::AllocaInst>(varBinding)
+                         ? llvm::cast<llvm::AllocaInst>(varBinding)->getAllocatedType()
+                         : llvm::cast<llvm::GlobalVariable>(varBinding)->getValueType();
+        return builder->CreateStore(convert(value, varTy), varBinding);
+    }
+
+    // ------------------------------------------
+    // Blocks: (begin <expressions>)
+
+    llvm::Value* genBegin(const Exp& exp, Env env){
+        // Block scope:
+        auto blockEnv = std::make_shared<Environment>(
+            std::map<std::string, llvm::Value*>{}, env);
+
+        // Compile each expression within the block.
+        // Result is the last evaluated expression.
+        llvm::Value* blockRes = builder->getInt32(0);
+        for (size_t i = 1; i < exp.list().size(); i++){
+            // Generate expression code.
+            blockRes = gen(exp.list()[i], blockEnv);
+        }
+        freeHeapArrays(blockEnv, blockRes);
+        return blockRes;
+    }
+
+    // ------------------------------------------
+    // Branches: (if <cond> <then> <else>)
+    //
+    // The else branch is optional. The result is the value of the branch
+    // taken (a PHI node) of the inferred type, if the branches have one,
+    // else of the wider branch type (numbers widen, other types must be
+    // the same). An if with a branch of no value (a set) gives 0. A
+    // constant condition compiles its branch only.
+
+    llvm::Value* genIf(const Exp& exp, Env env){
+        const auto& items = exp.list();
+        if (items.size() != 3 && items.size() != 4){
+            DIE << "if expects a condition, a branch and an optional else branch\n";
+        }
+
+        if (auto constant = foldConstant(items[1])){
+            if (!constant->isNullValue()){
+                return gen(items[2], env);
+            }
+            return items.size() == 4 ? gen(items[3], env) : builder->getInt32(0);
+        }
+
+        auto cond = genCondition(items[1], env);
+        auto ifType = llvmType(types->typeOf(exp));
+
+        auto thenBlock = createBB("then", fn);
+        auto elseBlock = createBB("else");
+        auto ifEndBlock = createBB("ifend");
+
+        builder->CreateCondBr(cond, thenBlock, elseBlock);
+
+        // Then branch. It may end in another block than it starts in, so
+        // the PHI takes the value from the block that branches to ifend.
+        builder->SetInsertPoint(thenBlock);
+        auto thenRes = gen(items[2], env);
+        if (ifType != nullptr){
+            thenRes = convert(thenRes, ifType);
+        }
+        builder->CreateBr(ifEndBlock);
+        thenBlock = builder->GetInsertBlock();
+
+        // Else branch.
+        elseBlock->insertInto(fn);
+        builder->SetInsertPoint(elseBlock);
+        llvm::Value* elseRes = items.size() == 4 ? gen(items[3], env) : builder->getInt32(0);
+        if (ifType != nullptr){
+            elseRes = convert(elseRes, ifType);
+        }
+        builder->CreateBr(ifEndBlock);
+        elseBlock = builder->GetInsertBlock();
+
+        // If end.
+        ifEndBlock->insertInto(fn);
+        builder->SetInsertPoint(ifEndBlock);
+
+        if (thenRes->getType()->isVoidTy() || elseRes->getType()->isVoidTy()){
+            return builder->getInt32(0);
+        }
+
+        // Branches of different types not inferred (array elements,
+        // vector lanes): the narrower one widens, in its own block.
+        if (thenRes->getType() != elseRes->getType()){
+            if (canConvert(elseRes, thenRes->getType())){
+                builder->SetInsertPoint(elseBlock->getTerminator());
+                elseRes = convert(elseRes, thenRes->getType());
+            } else if (canConvert(thenRes, elseRes->getType())){
+                builder->SetInsertPoint(thenBlock->getTerminator());
+                thenRes = convert(thenRes, elseRes->getType());
+            } else {
+                DIE << "if branches have values of unrelated types\n";
+            }
+            builder->SetInsertPoint(ifEndBlock);
+        }
+
+        auto phi = builder->CreatePHI(thenRes->getType(), 2, "tmpif");
+        phi->addIncoming(thenRes, thenBlock);
+        phi->addIncoming(elseRes, elseBlock);
+        return phi;
+    }
+
+    // ------------------------------------------
+    // Loops: (while <cond> <body>...)
+    //
+    // The condition is checked before each iteration. The result is 0.
+
+    llvm::Value* genWhile(const Exp& exp, Env env){
+        const auto& items = exp.list();
+        if (items.size() < 2){
+            DIE << "while expects a condition\n";
+        }
+
+        // A loop that never runs.
+        auto constant = foldConstant(items[1]);
+        if (constant != nullptr && constant->isNullValue()){
+            return builder->getInt32(0);
+        }
+
+        auto condBlock = createBB("cond", fn);
+        builder->CreateBr(condBlock);
+
+        auto bodyBlock = createBB("body");
+        auto loopEndBlock = createBB("loopend");
+
+        // Condition.
+        builder->SetInsertPoint(condBlock);
+        auto cond = genCondition(items[1], env);
+        builder->CreateCondBr(cond, bodyBlock, loopEndBlock);
+
+        // Body.
+        bodyBlock->insertInto(fn);
+        builder->SetInsertPoint(bodyBlock);
+        for (size_t i = 2; i < items.size(); i++){
+            gen(items[i], env);
+        }
+        builder->CreateBr(condBlock);
+
+        // Loop end.
+        loopEndBlock->insertInto(fn);
+        builder->SetInsertPoint(loopEndBlock);
+
+        return builder->getInt32(0);
+    }
+
+    // ------------------------------------------
+    // Functions: (def square ((x number)) -> number (* x x))
+    //
+    // Untyped parameters and a missing return type are numbers:
+    // (def square (x) (* x x)). The result is the value of the body.
+    //
+    // An array parameter may be annotated restrict, (x (array f64) restrict):
+    // see scopeArrayParams.
+    //
+    // Functions use the fast calling convention. They are internal unless
+    // other modules may call them (parallel or lazy units, sessions).
+    // Small functions are hinted for inlining, and self calls in tail
+    // position are guaranteed tail calls (musttail), so tail recursion
+    // runs in constant stack even at -O0.
+
+    llvm::Value* genDef(const Exp& exp, Env env){
+        // Save the current function, a def may be nested.
+        auto prevFn = fn;
+        auto prevBlock = builder->GetInsertBlock();
+
+        auto newFn = declareDef(exp, env);
+        auto fnName = std::string(exp.list()[1].string());
+        if (!newFn->empty()){
+            DIE << "Function \"" << fnName << "\" is already defined\n";
+        }
+        if (singleModule()){
+            newFn->setLinkage(llvm::Function::InternalLinkage);
+        }
+        fn = newFn;
+        createFunctionBlock(fn);
+
+        // Parameters are locals of the function's environment.
+        auto fnEnv = std::make_shared<Environment>(
+            std::map<std::string, llvm::Value*>{}, env);
+
+        // Array parameters: see scopeArrayParams.
+        auto prevArrayScopes = std::move(arrayScopes);
+        arrayScopes.clear();
+        std::vector<std::pair<std::string, llvm::Value*>> arrayParams;
+
+        const auto& params = exp.list()[2];
+        auto arg = fn->arg_begin();
+        for (const auto& param : params.list()){
+            auto paramName = extractVarName(param);
+            arg->setName(paramName);
+            auto paramBinding = allocVar(paramName, arg->getType(), fnEnv);
+            builder->CreateStore(arg, paramBinding);
+
+            auto isArray = arrayElementType(arg->getType()) != nullptr;
+            auto isRestrict = param.type == ExpType::LIST && param.list().size() > 2;
+            if (isRestrict && (param.list().size() != 3 ||
+                               !param.list()[2].isSymbol(restrictSymbol) || !isArray)){
+                DIE << "Parameter \"" << paramName << "\" of \"" << fnName
+                    << "\": only an array parameter can be annotated, with restrict\n";
+            }
+            if (isArray){
+                builder->CreateAlignmentAssumption(module->getDataLayout(),
+                                                   builder->CreateExtractValue(arg, 0),
+                                                   ARRAY_ALIGNMENT);
+            }
+            if (isRestrict){
+                arrayParams.emplace_back(paramName, paramBinding);
+            }
+            ++arg;
+        }
+        scopeArrayParams(exp, arrayParams);
+
+        auto result = gen(defBody(exp), fnEnv);
+        auto returnType = fn->getReturnType();
+        if (canConvert(result, returnType)){
+            result = convert(result, returnType);
+        }
+        if (result->getType() != returnType){
+            if (!result->getType()->isVoidTy()){
+                DIE << "Function \"" << fnName << "\" returns a value of another type\n";
+            }
+            result = llvm::Constant::getNullValue(returnType);
+        }
+        freeHeapArrays(fnEnv, result);
+        builder->CreateRet(result);
+
+        markTailCalls(fn);
+        if (fn->getInstructionCount() <= INLINE_HINT_MAX_INSTRUCTIONS){
+            fn->addFnAttr(llvm::Attribute::InlineHint);
+        }
+        verifyGenerated(*fn);
+
+        // Back to the enclosing function.
+        fn = prevFn;
+        builder->SetInsertPoint(prevBlock);
+        arrayScopes = std::move(prevArrayScopes);
+
+        return newFn;
+    }
+
+    /**
+     * Declares the function of a def (its prototype, with the fast
+     * calling convention), or returns the existing declaration.
+     */
+    llvm::Function* declareDef(const Exp& exp, Env env){
+        if (exp.list().size() < 4 || exp.list()[1].type != ExpType::SYMBOL ||
+            exp.list()[2].type != ExpType::LIST){
+            DIE << "def expects a name, parameters and a body\n";
+        }
+        auto fnName = std::string(exp.list()[1].string());
+
+        // A top-level def of a session input may replace an earlier one.
+        auto sessionTopLevel = session != nullptr && env == GlobalEnv;
+        if (auto existing = module->getFunction(fnName); existing != nullptr && !sessionTopLevel){
+            env->define(fnName, existing);
+            return existing;
+        }
+
+        // Types: annotated, or inferred from the calls and the body.
+        auto signature = types->signatureOf(exp);
+
+        std::vector<llvm::Type*> paramTypes;
+        const auto& params = exp.list()[2].list();
+        for (size_t i = 0; i < params.size(); i++){
+            auto type = signature != nullptr ? llvmType(signature->params[i].type) : nullptr;
+            paramTypes.push_back(type != nullptr ? type : extractVarType(params[i]));
+        }
+
+        auto hasReturnType = exp.list()[3].isSymbol(arrowSymbol);
+        auto returnType = signature != nullptr ? llvmType(signature->result.type) : nullptr;
+        if (returnType == nullptr){
+            returnType = hasReturnType ? getTypefromExp(exp.list()[4])
+                                       : builder->getInt32Ty();
+        }
+
+        auto fnType = llvm::FunctionType::get(returnType, paramTypes, /* vararg */ false);
+        if (sessionTopLevel){
+            return sessionDef(fnName, fnType);
+        }
+
+        auto newFn = createFunctionProto(fnName, fnType, env);
+        newFn->setCallingConv(llvm::CallingConv::Fast);
+        return newFn;
+    }
+
+    /**
+     * Body of a def, after its optional return type.
+     */
+    const Exp& defBody(const Exp& exp){
+        auto hasReturnType = exp.list()[3].isSymbol(arrowSymbol);
+        size_t bodyIndex = hasReturnType ? 5 : 3;
+        if (exp.list().size() != bodyIndex + 1){
+            DIE << "def expects a single body expression\n";
+        }
+        return exp.list()[bodyIndex];
+    }
+
+    /**
+     * Functions of at most this many instructions are hinted for inlining.
+     */
+    static constexpr unsigned INLINE_HINT_MAX_INSTRUCTIONS = 32;
+
+    /**
+     * Whether a function is only called from the module it is defined
+     * in.
+     */
+    bool singleModule() const {
+        return !isUnit && session == nullptr && options.codegenThreads <= 1 && !lazyJIT();
+    }
+
+    /**
+     * Marks the self calls in tail position of a function as musttail.
+     *
+     * A call is in tail position if its value is returned unchanged: by a
+     * ret right after it, or through the PHI nodes of if expressions,
+     * each alone in a block that returns it or branches on. Such a call
+     * returns directly instead: its branch to the join block becomes a
+     * ret, and the PHI loses the incoming value.
+     *
+     * A musttail callee must not access the caller's allocas: in a
+     * function with stack arrays, a self call passing an array (or any
+     * pointer) stays a plain call, as the array may be one of them.
+     */
+    void markTailCalls(llvm::Function* function){
+        auto hasStackArrays = false;
+        for (auto& instruction : function->getEntryBlock()){
+            auto alloca = llvm::dyn_cast<llvm::AllocaInst>(&instruction);
+            if (alloca != nullptr && alloca->getAllocatedType()->isArrayTy()){
+                hasStackArrays = true;
+            }
+        }
+
+        std::vector<llvm::CallInst*> selfCalls;
+        for (auto& block : *function){
+            for (auto& instruction : block){
+                auto call = llvm::dyn_cast<llvm::CallInst>(&instruction);
+                if (call != nullptr && call->getCalledFunction() == function &&
+                    !(hasStackArrays && passesPointers(call))){
+                    selfCalls.push_back(call);
+                }
+            }
+        }
+
+        for (auto call : selfCalls){
+            auto callBlock = call->getParent();
+            if (call->getNextNode() != callBlock->getTerminator()){
+                continue;
+            }
+
+            llvm::Value* value = call;
+            auto block = callBlock;
+            llvm::PHINode* firstPhi = nullptr;
+
+            for (;;){
+                auto terminator = block->getTerminator();
+                if (auto ret = llvm::dyn_cast<llvm::ReturnInst>(terminator)){
+                    if (ret->getReturnValue() != value){
+                        value = nullptr;
+                    }
+                    break;
+                }
+
+                auto branch = llvm::dyn_cast<llvm::BranchInst>(terminator);
+                if (branch == nullptr || branch->isConditional()){
+                    value = nullptr;
+                    break;
+                }
+
+                auto next = branch->getSuccessor(0);
+                auto phi = llvm::dyn_cast<llvm::PHINode>(&next->front());
+                if (phi == nullptr || phi->getNextNode() != next->getTerminator() ||
+                    phi->getIncomingValueForBlock(block) != value || !phi->hasOneUse()){
+                    value = nullptr;
+                    break;
+                }
+
+                if (firstPhi == nullptr){
+                    firstPhi = phi;
+                }
+                value = phi;
+                block = next;
+            }
+
+            if (value == nullptr){
+                continue;
+            }
+
+            if (firstPhi != nullptr){
+                firstPhi->removeIncomingValue(callBlock, /* DeletePHIIfEmpty */ false);
+                callBlock->getTerminator()->eraseFromParent();
+                llvm::ReturnInst::Create(function->getContext(), call, callBlock);
+            }
+            call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+        }
+    }
+
+    /**
+     * Whether a call has an argument that is, or holds, a pointer.
+     */
+    static bool passesPointers(llvm::CallInst* call){
+        for (auto& arg : call->args()){
+            auto type = arg->getType();
+            if (type->isPointerTy() || arrayElementType(type) != nullptr){
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // ------------------------------------------
+    // Function calls: (square 2)
+
+    llvm::Value* genCall(const Exp& exp, Env env){
+        auto callee = llvm::dyn_cast<llvm::Function>(gen(exp.list()[0], env));
+        if (callee == nullptr){
+            DIE << "Cannot call a value that is not a function\n";
+        }
+
+        auto argsCount = exp.list().size() - 1;
+        if (argsCount != callee->arg_size()){
+            auto name = exp.list()[0].type == ExpType::SYMBOL ? std::string(exp.list()[0].string())
+                                                              : callee->getName().str();
+            DIE << "Function \"" << name << "\" expects "
+                << callee->arg_size() << " arguments, got " << argsCount << "\n";
+        }
+
+        std::vector<llvm::Value*> args;
+        for (size_t i = 1; i < exp.list().size(); i++){
+            auto arg = gen(exp.list()[i], env);
+            auto paramType = callee->getArg(i - 1)->getType();
+            if (!canConvert(arg, paramType)){
+                DIE << "Argument " << i << " of \"" << callee->getName().str()
+                    << "\" has the wrong type\n";
+            }
+            args.push_back(convert(arg, paramType));
+        }
+
+        auto call = builder->CreateCall(callee, args);
+        call->setCallingConv(callee->getCallingConv());
+        return call;
+    }
+
+    /**
+     * Generates a condition as a boolean: a number is true if not zero.
+     */
+    llvm::Value* genCondition(const Exp& exp, Env env){
+        auto value = gen(exp, env);
+        auto type = value->getType();
+        if (type->isIntegerTy(1)){
+            return value;
+        }
+        if (type->isFloatingPointTy()){
+            return builder->CreateFCmpUNE(value, llvm::ConstantFP::get(type, 0.0));
+        }
+        if (!type->isIntegerTy()){
+            DIE << "Condition must be a boolean or a number\n";
+        }
+        return builder->CreateICmpNE(value, llvm::ConstantInt::get(type, 0));
+    }
+
+    // ------------------------------------------
+    // Vector lanes: (extract v 0), (insert v 0 x)
+    //
+    // extract gives a lane of a vector, insert a copy of the vector with
+    // the lane set to x (store it back with set). A constant lane index
+    // is checked against the vector's lanes when compiled, any other at
+    // run time, as array indices are.
+
+    llvm::Value* genExtract(const Exp& exp, Env env){
+        if (exp.list().size() != 3){
+            DIE << "extract expects a vector and a lane\n";
+        }
+        auto vector = genVector(exp.list()[1], env);
+        return builder->CreateExtractElement(vector, genLane(exp.list()[2], vector, env));
+    }
+
+    llvm::Value* genInsert(const Exp& exp, Env env){
+        if (exp.list().size() != 4){
+            DIE << "insert expects a vector, a lane and a value\n";
+        }
+        auto vector = genVector(exp.list()[1], env);
+        auto lane = genLane(exp.list()[2], vector, env);
+        auto value = convert(gen(exp.list()[3], env), vector->getType()->getScalarType());
+        return builder->CreateInsertElement(vector, value, lane);
+    }
+
+    // ------------------------------------------
+    // Shuffles: (shuffle v (3 2 1 0)), (shuffle v w (0 4 1 5))
+    //
+    // Picks lanes of one vector, or of two vectors of the same type (the
+    // lanes of w follow those of v), by a list of constant indices. The
+    // result has a lane per index.
+
+    llvm::Value* genShuffle(const Exp& exp, Env env){
+        const auto& items = exp.list();
+        if (items.size() != 3 && items.size() != 4){
+            DIE << "shuffle expects one or two vectors and a list of lanes\n";
+        }
+
+        auto lhs = genVector(items[1], env);
+        auto rhs = items.size() == 4 ? genVector(items[2], env) : nullptr;
+        if (rhs != nullptr && rhs->getType() != lhs->getType()){
+            DIE << "shuffle expects vectors of the same type\n";
+        }
+
+        const auto& lanes = items[items.size() - 1];
+        auto inputLanes = llvm::cast<llvm::FixedVectorType>(lhs->getType())->getNumElements() *
+                          (rhs != nullptr ? 2 : 1);
+        if (lanes.type != ExpType::LIST || lanes.list().empty() ||
+            lanes.list().size() > MAX_VECTOR_LANES){
+            DIE << "shuffle expects a list of lanes\n";
+        }
+        std::vector<int> mask;
+        for (const auto& lane : lanes.list()){
+            if (lane.type != ExpType::NUMBER || lane.number < 0 || lane.number >= inputLanes){
+                DIE << "shuffle lanes must be numbers less than " << inputLanes << "\n";
+            }
+            mask.push_back(lane.number);
+        }
+
+        return rhs != nullptr ? builder->CreateShuffleVector(lhs, rhs, mask)
+                              : builder->CreateShuffleVector(lhs, mask);
+    }
+
+    // ------------------------------------------
+    // Horizontal reductions: (reduce + v), (reduce * v), (reduce min v),
+    // (reduce max v)
+    //
+    // Combine the lanes of a vector into a scalar, with the target's
+    // horizontal instructions. Integers wrap, min and max are signed.
+    // Float sums and products may be reassociated (lanes combined
+    // pairwise), so their rounding may differ from a loop.
+
+    llvm::Value* genReduce(const Exp& exp, Env env){
+        const auto& items = exp.list();
+        if (items.size() != 3 || items[1].type != ExpType::SYMBOL){
+            DIE << "reduce expects an operator (+, *, min or max) and a vector\n";
+        }
+
+        auto vector = genVector(items[2], env);
+        auto element = vector->getType()->getScalarType();
+        auto isFloat = element->isFloatingPointTy();
+        auto op = items[1].string();
+
+        llvm::Value* result;
+        if (op == "+"){
+            result = isFloat ? builder->CreateFAddReduce(llvm::ConstantFP::getNegativeZero(element), vector)
+                             : builder->CreateAddReduce(vector);
+        } else if (op == "*"){
+            result = isFloat ? builder->CreateFMulReduce(llvm::ConstantFP::get(element, 1.0), vector)
+                             : builder->CreateMulReduce(vector);
+        } else if (op == "min"){
+            result = isFloat ? builder->CreateFPMinReduce(vector)
+                             : builder->CreateIntMinReduce(vector, /* IsSigned */ true);
+        } else if (op == "max"){
+            result = isFloat ? builder->CreateFPMaxReduce(vector)
+                             : builder->CreateIntMaxReduce(vector, /* IsSigned */ true);
+        } else {
+            DIE << "reduce expects +, *, min or max, got " << op << "\n";
+        }
+
+        if (isFloat && (op == "+" || op == "*")){
+            llvm::cast<llvm::Instruction>(result)->setHasAllowReassoc(true);
+        }
+        return result;
+    }
+
+    /**
+     * Generates a value that must be a vector.
+     */
+    llvm::Value* genVector(const Exp& exp, Env env){
+        auto value = gen(exp, env);
+        if (!value->getType()->isVectorTy()){
+            DIE << "Expected a vector, declared e.g. (var (v (vec 4 f32)) 0)\n";
+        }
+        return value;
+    }
+
+    /**
+     * Generates the lane index of a vector: an integer, checked against
+     * the vector's lanes, when compiled if it is a constant.
+     */
+    llvm::Value* genLane(const Exp& exp, llvm::Value* vector, Env env){
+        auto lane = gen(exp, env);
+        if (!lane->getType()->isIntegerTy() || lane->getType()->isIntegerTy(1)){
+            DIE << "Vector lane must be an integer\n";
+        }
+        auto lanes = llvm::cast<llvm::FixedVectorType>(vector->getType())->getNumElements();
+        if (auto constant = llvm::dyn_cast<llvm::ConstantInt>(lane)){
+            if (constant->getValue().uge(lanes)){
+                DIE << "Vector lane " << constant->getSExtValue()
+                    << " is out of range, the vector has " << lanes << " lanes\n";
+            }
+            return lane;
+        }
+
+        // Negative lanes are above any count as unsigned.
+        lane = convert(lane, builder->getInt64Ty());
+        genRuntimeCheck(builder->CreateICmpULT(lane, builder->getInt64(lanes)),
+                        "Fatal error: vector lane %ld is out of range (%ld lanes)\n",
+                        {lane, builder->getInt64(lanes)});
+        return lane;
+    }
+
+    // ------------------------------------------
+    // Arrays: (var (a (array 100 f64)) 0), (get a i), (put a i x), (len a)
+    //
+    // An array is a length and a pointer to contiguous elements (i32,
+    // i64, f32 or f64), aligned to ARRAY_ALIGNMENT. Arrays are references:
+    // set and calls share the elements. The length is any expression;
+    // small arrays of constant length are allocated on the stack, others
+    // (and the globals of a session) on the heap. A heap array is freed
+    // at the end of the block (or def) it is declared in, and when its
+    // declaration runs again in a loop; globals of a session are never
+    // freed. An array cannot outlive its block: a block or def that
+    // allocates arrays cannot have an array value, or set an outer
+    // variable to one.
+    //
+    // Indices are checked against the length with one unsigned compare,
+    // and an exit on failure marked unlikely. In a counted loop, the
+    // optimizer drops the check of an index below the loop bound, and
+    // turns the others into countable loop exits, which the vectorizer
+    // accepts. Variables used as indices are i64, as lengths, so the loop
+    // counter needs no sign extension.
+
+    llvm::Value* genGet(const Exp& exp, Env env){
+        if (exp.list().size() != 3){
+            DIE << "get expects an array and an index\n";
+        }
+        llvm::Type* elementType;
+        auto element = genElementPointer(exp, env, elementType);
+        auto load = builder->CreateLoad(elementType, element);
+        scopeArrayAccess(load, exp.list()[1], env);
+        return load;
+    }
+
+    llvm::Value* genPut(const Exp& exp, Env env){
+        if (exp.list().size() != 4){
+            DIE << "put expects an array, an index and a value\n";
+        }
+        llvm::Type* elementType;
+        auto element = genElementPointer(exp, env, elementType);
+        auto value = convert(gen(exp.list()[3], env), elementType);
+        scopeArrayAccess(builder->CreateStore(value, element), exp.list()[1], env);
+        return value;
+    }
+
+    llvm::Value* genLen(const Exp& exp, Env env){
+        if (exp.list().size() != 2){
+            DIE << "len expects an array\n";
+        }
+        return builder->CreateExtractValue(genArrayValue(exp.list()[1], env), 1);
+    }
+
+    /**
+     * Allocates the array of a var declaration, (array <length> <type>),
+     * with every element set to the initializer. An (array <type>)
+     * declaration refers to the array of the initializer instead.
+     */
+    llvm::Value* genArray(const Exp& type_, llvm::Value* init, Env env){
+        const auto& items = type_.list();
+        if (items.size() == 2){
+            return init;
+        }
+
+        auto arrayTy = llvm::cast<llvm::StructType>(getTypefromExp(type_));
+        auto elementType = arrayElementType(arrayTy);
+        auto fill = convert(init, elementType);
+
+        auto length = gen(items[1], env);
+        if (!length->getType()->isIntegerTy() || length->getType()->isIntegerTy(1)){
+            DIE << "Array length must be an integer\n";
+        }
+        length = convert(length, builder->getInt64Ty());
+
+        auto elementSize = module->getDataLayout().getTypeAllocSize(elementType);
+        auto constantLength = llvm::dyn_cast<llvm::ConstantInt>(length);
+        llvm::Value* data;
+
+        // Globals of a session input outlive its stack frame.
+        auto sessionGlobal = session != nullptr && env == GlobalEnv;
+
+        if (constantLength != nullptr && !constantLength->isNegative() &&
+            constantLength->getZExtValue() * elementSize <= MAX_STACK_ARRAY_BYTES &&
+            !sessionGlobal){
+            setVarsInsertPoint(fn);
+            auto storage = varsBuilder->CreateAlloca(
+                llvm::ArrayType::get(elementType, constantLength->getZExtValue()));
+            storage->setAlignment(llvm::Align(ARRAY_ALIGNMENT));
+            data = builder->CreateConstInBoundsGEP2_64(storage->getAllocatedType(), storage, 0, 0);
+            arrayOwners.insert(env.get());
+        } else {
+            // Sizes are rounded up to the alignment, as aligned_alloc needs.
+            auto maxLength = builder->getInt64(INT64_MAX / elementSize - ARRAY_ALIGNMENT);
+            genRuntimeCheck(builder->CreateICmpULE(length, maxLength),
+                            "Fatal error: array length %ld is negative or too large\n",
+                            {length});
+            auto size = builder->CreateAnd(
+                builder->CreateAdd(builder->CreateMul(length, builder->getInt64(elementSize)),
+                                   builder->getInt64(ARRAY_ALIGNMENT - 1)),
+                builder->getInt64(-(int64_t)ARRAY_ALIGNMENT));
+            auto bytePtrTy = builder->getInt8Ty()->getPointerTo();
+            auto alignedAlloc = module->getOrInsertFunction(
+                "aligned_alloc", llvm::FunctionType::get(
+                    bytePtrTy, {builder->getInt64Ty(), builder->getInt64Ty()}, /* vararg */ false));
+            auto memory = builder->CreateCall(alignedAlloc, {builder->getInt64(ARRAY_ALIGNMENT), size});
+            genRuntimeCheck(builder->CreateIsNotNull(memory),
+                            "Fatal error: cannot allocate an array of %ld elements\n", {length});
+            if (!sessionGlobal){
+                ownHeapArray(memory, env);
+            }
+            data = builder->CreateBitCast(memory, elementType->getPointerTo());
+        }
+
+        genFill(elementType, data, length, fill);
+
+        llvm::Value* array = llvm::UndefValue::get(arrayTy);
+        array = builder->CreateInsertValue(array, data, 0);
+        return builder->CreateInsertValue(array, length, 1);
+    }
+
+    /**
+     * Makes a heap array owned by the scope of its declaration, which
+     * frees it at its end (see freeHeapArrays). Its memory is kept in a
+     * slot, null while not allocated: a declaration run again, in a loop,
+     * frees the array of the previous run.
+     */
+    void ownHeapArray(llvm::Value* memory, Env env){
+        auto bytePtrTy = builder->getInt8Ty()->getPointerTo();
+
+        setVarsInsertPoint(fn);
+        auto slot = varsBuilder->CreateAlloca(bytePtrTy, 0, "heaparray");
+        varsBuilder->CreateStore(llvm::ConstantPointerNull::get(bytePtrTy), slot);
+
+        builder->CreateCall(freeFunction(), builder->CreateLoad(bytePtrTy, slot));
+        builder->CreateStore(memory, slot);
+        heapArrays[env.get()].push_back(slot);
+        arrayOwners.insert(env.get());
+    }
+
+    /**
+     * Frees the heap arrays of a scope at its end. The value of a scope
+     * that allocates arrays, on the stack or the heap, cannot be an
+     * array: it may be one of them, dead once the scope (or the frame of
+     * a def) ends.
+     */
+    void freeHeapArrays(Env scope, llvm::Value* result){
+        if (arrayOwners.erase(scope.get()) == 0){
+            return;
+        }
+        if (arrayElementType(result->getType()) != nullptr){
+            DIE << "An array cannot be the value of a block or def that allocates "
+                << "arrays: they are freed at its end\n";
+        }
+
+        auto arrays = heapArrays.find(scope.get());
+        if (arrays == heapArrays.end()){
+            return;
+        }
+
+        auto bytePtrTy = builder->getInt8Ty()->getPointerTo();
+        for (auto slot : arrays->second){
+            builder->CreateCall(freeFunction(), builder->CreateLoad(bytePtrTy, slot));
+            builder->CreateStore(llvm::ConstantPointerNull::get(bytePtrTy), slot);
+        }
+        heapArrays.erase(arrays);
+    }
+
+    /**
+     * void free(void* memory);
+     */
+    llvm::FunctionCallee freeFunction(){
+        auto bytePtrTy = builder->getInt8Ty()->getPointerTo();
+        return module->getOrInsertFunction(
+            "free", llvm::FunctionType::get(builder->getVoidTy(), {bytePtrTy}, /* vararg */ false));
+    }
+
+    /**
+     * Sets the elements of an array to a value: a memset for zero, or a
+     * loop.
+     */
+    void genFill(llvm::Type* elementType, llvm::Value* data, llvm::Value* length,
+                 llvm::Value* value){
+        auto constant = llvm::dyn_cast<llvm::Constant>(value);
+        if (constant != nullptr && constant->isNullValue()){
+            auto elementSize = module->getDataLayout().getTypeAllocSize(elementType);
+            builder->CreateMemSet(data, builder->getInt8(0),
+                                  builder->CreateMul(length, builder->getInt64(elementSize)),
+                                  llvm::MaybeAlign(ARRAY_ALIGNMENT));
+            return;
+        }
+
+        auto preBlock = builder->GetInsertBlock();
+        auto condBlock = createBB("fill", fn);
+        auto bodyBlock = createBB("fillbody", fn);
+        auto endBlock = createBB("fillend", fn);
+        builder->CreateBr(condBlock);
+
+        builder->SetInsertPoint(condBlock);
+        auto index = builder->CreatePHI(builder->getInt64Ty(), 2);
+        index->addIncoming(builder->getInt64(0), preBlock);
+        builder->CreateCondBr(builder->CreateICmpSLT(index, length), bodyBlock, endBlock);
+
+        builder->SetInsertPoint(bodyBlock);
+        builder->CreateStore(value, builder->CreateInBoundsGEP(elementType, data, index));
+        index->addIncoming(builder->CreateNUWAdd(index, builder->getInt64(1)), bodyBlock);
+        builder->CreateBr(condBlock);
+
+        builder->SetInsertPoint(endBlock);
+    }
+
+    /**
+     * Pointer to the element of a get or put form, after checking the
+     * index against the array's length.
+     */
+    llvm::Value* genElementPointer(const Exp& exp, Env env, llvm::Type*& elementType){
+        auto array = genArrayValue(exp.list()[1], env);
+        elementType = arrayElementType(array->getType());
+
+        auto index = gen(exp.list()[2], env);
+        if (!index->getType()->isIntegerTy() || index->getType()->isIntegerTy(1)){
+            DIE << "Array index must be an integer\n";
+        }
+        index = convert(index, builder->getInt64Ty());
+
+        // Negative indices are above any length as unsigned.
+        auto length = builder->CreateExtractValue(array, 1);
+        genRuntimeCheck(builder->CreateICmpULT(index, length),
+                        "Fatal error: array index %ld is out of bounds (length %ld)\n",
+                        {index, length});
+
+        auto data = builder->CreateExtractValue(array, 0);
+        return builder->CreateInBoundsGEP(elementType, data, index);
+    }
+
+    /**
+     * Generates a value that must be an array.
+     */
+    llvm::Value* genArrayValue(const Exp& exp, Env env){
+        auto value = gen(exp, env);
+        if (arrayElementType(value->getType()) == nullptr){
+            DIE << "Expected an array, declared e.g. (var (a (array 10 f64)) 0)\n";
+        }
+        return value;
+    }
+
+    /**
+     * Continues if a runtime check holds. Otherwise the program prints
+     * the message (a printf format) and exits with status 1; that path
+     * is marked unlikely, so the optimizer lays it out of the hot path.
+     */
+    void genRuntimeCheck(llvm::Value* ok, std::string_view message,
+                         std::initializer_list<llvm::Value*> args){
+        auto failBlock = createBB("checkfail", fn);
+        auto passBlock = createBB("checkpass", fn);
+        builder->CreateCondBr(ok, passBlock, failBlock,
+                              llvm::MDBuilder(module->getContext())
+                                  .createBranchWeights(CHECK_PASS_WEIGHT, 1));
+
+        builder->SetInsertPoint(failBlock);
+        std::vector<llvm::Value*> printfArgs{stringLiteral(message)};
+        printfArgs.insert(printfArgs.end(), args);
+        builder->CreateCall(module->getFunction("printf"), printfArgs);
+
+        // exit flushes the output printed so far.
+        auto exitFn = llvm::cast<llvm::Function>(
+            module->getOrInsertFunction(
+                      "exit", llvm::FunctionType::get(builder->getVoidTy(),
+                                                      {builder->getInt32Ty()},
+                                                      /* vararg */ false))
+                .getCallee());
+        exitFn->setDoesNotReturn();
+        builder->CreateCall(exitFn, {builder->getInt32(1)});
+        builder->CreateUnreachable();
+
+        builder->SetInsertPoint(passBlock);
+    }
+
+    /**
+     * Tags the accesses through the restrict array parameters of a def
+     * with alias scopes, telling the optimizer that they do not overlap,
+     * so the vectorizer needs no runtime overlap checks.
+     *
+     * As with C's restrict, the annotation is a promise of the caller:
+     * a def must not be passed the same array for two restrict
+     * parameters if it writes to it. Other parameters may overlap.
+     * Parameters assigned with set are not tagged.
+     */
+    void scopeArrayParams(const Exp& def,
+                          const std::vector<std::pair<std::string, llvm::Value*>>& params){
+        llvm::StringSet<> assigned;
+        collectSetNames(defBody(def), assigned);
+
+        llvm::MDBuilder mdBuilder(module->getContext());
+        llvm::MDNode* domain = nullptr;
+        std::vector<llvm::Value*> scoped;
+        std::vector<llvm::Metadata*> scopes;
+        for (const auto& [name, binding] : params){
+            if (assigned.count(name)){
+                continue;
+            }
+            if (domain == nullptr){
+                domain = mdBuilder.createAnonymousAliasScopeDomain(fn->getName());
+            }
+            scoped.push_back(binding);
+            scopes.push_back(mdBuilder.createAnonymousAliasScope(domain, name));
+        }
+        if (scoped.size() < 2){
+            return;
+        }
+
+        for (size_t i = 0; i < scoped.size(); i++){
+            std::vector<llvm::Metadata*> others;
+            for (size_t j = 0; j < scopes.size(); j++){
+                if (j != i){
+                    others.push_back(scopes[j]);
+                }
+            }
+            arrayScopes[scoped[i]] = {llvm::MDNode::get(module->getContext(), scopes[i]),
+                                      llvm::MDNode::get(module->getContext(), others)};
+        }
+    }
+
+    /**
+     * Tags a load or store of an element with the alias scope of its
+     * array, if it is a scoped array parameter.
+     */
+    void scopeArrayAccess(llvm::Instruction* access, const Exp& array, Env env){
+        if (array.type != ExpType::SYMBOL || arrayScopes.empty()){
+            return;
+        }
+        auto found = arrayScopes.find(env->lookup(std::string(array.string())));
+        if (found != arrayScopes.end()){
+            access->setMetadata(llvm::LLVMContext::MD_alias_scope, found->second.scope);
+            access->setMetadata(llvm::LLVMContext::MD_noalias, found->second.noalias);
+        }
+    }
+
+    /**
+     * Names assigned by the set forms of an expression.
+     */
+    void collectSetNames(const Exp& exp, llvm::StringSet<>& names){
+        if (exp.type != ExpType::LIST || exp.list().empty()){
+            return;
+        }
+        const auto& items = exp.list();
+        if (items[0].isSymbol(setSymbol) && items.size() == 3 &&
+            items[1].type == ExpType::SYMBOL){
+            auto name = items[1].string();
+            names.insert(llvm::StringRef(name.data(), name.size()));
+        }
+        for (const auto& item : items){
+            collectSetNames(item, names);
+        }
+    }
+
+    /**
+     * Element type of an array type, null for other types.
+     */
+    static llvm::Type* arrayElementType(llvm::Type* type){
+        auto array = llvm::dyn_cast<llvm::StructType>(type);
+        if (array == nullptr || array->getNumElements() != 2 ||
+            !array->getElementType(0)->isPointerTy() ||
+            !array->getElementType(1)->isIntegerTy(64)){
+            return nullptr;
+        }
+        return array->getElementType(0)->getPointerElementType();
+    }
 
-                    // 2. Global vars:
-                    else if(auto globalVar = llvm::dyn_cast<llvm::GlobalVariable>(value)) {
-                        return builder->CreateLoad(globalVar->getInitializer()->getType(), 
-                                                    globalVar, varName.c_str());
-                    }
-                }
-            /*
-            * Lists
-            // ------------------------------------------
-            */
-            case ExpType::LIST:
-                auto tag = exp.list[0];
-            /*
-            * Spachial cases
-            // ------------------------------------------
-            */
-            if (tag.type == ExpType::SYMBOL){
-                auto op = tag.string;
-                // ------------------------------------------
-                // Variable declaration: (var x (+ y 10))
-                // 
-                // Typed: (var (x number) 42)
-                //
-                // Note: locals are allocated on the stack.
+    /**
+     * Alignment of array elements, for vector loads and stores.
+     */
+    static constexpr uint64_t ARRAY_ALIGNMENT = 32;
+
+    /**
+     * Largest array of constant length allocated on the stack.
+     */
+    static constexpr uint64_t MAX_STACK_ARRAY_BYTES = 64 * 1024;
 
-                if (op == "var"){
+    /**
+     * Branch weight of a runtime check passing, against 1 for failing.
+     */
+    static constexpr uint32_t CHECK_PASS_WEIGHT = 1 << 20;
+
+    // ------------------------------------------
+    // printf extern function:
+    //
+    // printf ("Value: %d" 42)
+    //
+
+    llvm::Value* genPrintf(const Exp& exp, Env env){
+        auto printfFn = module->getFunction("printf");
+        std::vector<llvm::Value*> args{};
+        for (size_t i = 1; i < exp.list().size(); i++)
+        {
+            // Varargs promote booleans to int and f32 to f64, as in C.
+            auto arg = gen(exp.list()[i], env);
+            if (arg->getType()->isIntegerTy(1)){
+                arg = builder->CreateZExt(arg, builder->getInt32Ty());
+            }
+            if (arg->getType()->isFloatTy()){
+                arg = builder->CreateFPExt(arg, builder->getDoubleTy());
+            }
+            args.push_back(arg);
+        }
+
+        return builder->CreateCall(printfFn, args);
+    }
 
-                    auto varNameDecl = exp.list[1];
-                    //auto varName = exp.list[1].string;
-                    auto varName = extractVarName(varNameDecl);
+    // ------------------------------------------
+    // Operators: (+ x 1), (- x), (* 2 x y), (/ x 2), (< x 10), (== x y)
+    //
+    // Operands are converted to the operator's inferred type, the widest
+    // of them (i32 < i64 < f64). Integer arithmetic wraps, with signed
+    // division, and integer comparisons are signed; comparisons give a
+    // boolean. + - * take one or more operands, / two or more, applied
+    // left to right: (- x) negates, (+ x) and (* x) are x. Comparisons
+    // take two.
+
+    llvm::Value* genOperator(const Exp& exp, Env env){
+        // Constant operands: the whole form folds to a constant, no IR.
+        if (auto folded = foldConstant(exp)){
+            return folded;
+        }
 
-                    // Initializer:
-                    auto init = gen(exp.list[2], env);
+        if (types->typeOf(exp) == EvaType::Opaque){
+            return genUntypedOperator(exp, env);
+        }
 
-                    // Type:
-                    auto varTy = extractVarType(varNameDecl);
+        const auto& items = exp.list();
+        auto type = llvmType(types->typeOf(exp));
+        auto op = operatorOf(exp, type);
+        auto operand = [&](const Exp& item){ return convert(gen(item, env), type); };
 
-                    // Variable:
-                    auto varBinding = allocVar(varName, varTy, env);
+        if (op.isComparison()){
+            auto lhs = operand(items[1]);
+            auto rhs = operand(items[2]);
+            checkOperandTypes(exp, lhs, rhs);
+            return builder->CreateCmp(op.predicate, lhs, rhs);
+        }
 
-                    // Set value:
-                    return builder->CreateStore(init, varBinding);
+        if (items.size() == 2){
+            auto value = operand(items[1]);
+            checkOperandTypes(exp, value, value);
+            if (op.opcode == llvm::Instruction::FSub){
+                return builder->CreateFNeg(value);
+            }
+            return op.opcode == llvm::Instruction::Sub ? builder->CreateNeg(value) : value;
+        }
 
-                    //return createGlobalVar(varName, (llvm::Constant*) init);
+        // + and * on integers are associative and commutative with
+        // wrapping: their constant operands are folded into one, applied
+        // last. Not on f64, where reassociating changes the rounding.
+        auto commutative = llvm::Instruction::isCommutative(op.opcode) &&
+                           op.opcode != llvm::Instruction::FAdd &&
+                           op.opcode != llvm::Instruction::FMul;
+        llvm::Value* result = nullptr;
+        llvm::Constant* constant = nullptr;
+
+        for (size_t i = 1; i < items.size(); i++){
+            if (commutative){
+                if (auto folded = foldConstant(items[i])){
+                    folded = llvm::cast<llvm::Constant>(convert(folded, type));
+                    if (constant != nullptr){
+                        checkOperandTypes(exp, constant, folded);
+                    }
+                    constant = constant == nullptr ? folded
+                                                   : foldBinary(op, constant, folded);
+                    continue;
                 }
-                // ------------------------------------------
-                // Variable update: (set x 100)
+            }
+            auto value = operand(items[i]);
+            if (result != nullptr){
+                checkOperandTypes(exp, result, value);
+            }
+            result = result == nullptr ? value : builder->CreateBinOp(op.binaryOp(), result, value);
+        }
+
+        if (constant != nullptr){
+            checkOperandTypes(exp, result, constant);
+            result = builder->CreateBinOp(op.binaryOp(), result, constant);
+        }
+        return result;
+    }
 
-                else if (op == "set") {
-                    // Value:
-                    auto value = gen(exp.list[2], env);
+    /**
+     * Operator form on vectors, element-wise, on their lanes or on array
+     * elements. Their types are not inferred: operands are converted to
+     * the widest of their values' types, a vector if any (scalars splat
+     * to its lanes). Comparisons of vectors give a vector of booleans.
+     */
+    llvm::Value* genUntypedOperator(const Exp& exp, Env env){
+        const auto& items = exp.list();
+        auto op = operators[items[0].symbol->id];
+        checkOperands(exp, op);
+
+        std::vector<llvm::Value*> values;
+        llvm::Type* type = nullptr;
+        for (size_t i = 1; i < items.size(); i++){
+            auto value = gen(items[i], env);
+            if (type == nullptr || (!type->isVectorTy() && !canConvert(value, type))){
+                type = value->getType();
+            }
+            values.push_back(value);
+        }
+        for (auto& value : values){
+            value = convert(value, type);
+            checkOperandTypes(exp, value, values[0]);
+        }
+        op = operatorOf(exp, type);
 
-                    auto varName = exp.list[1].string;
+        if (op.isComparison()){
+            return builder->CreateCmp(op.predicate, values[0], values[1]);
+        }
+        if (values.size() == 1){
+            if (op.opcode == llvm::Instruction::FSub){
+                return builder->CreateFNeg(values[0]);
+            }
+            return op.opcode == llvm::Instruction::Sub ? builder->CreateNeg(values[0]) : values[0];
+        }
 
-                    // Variable:
-                    auto varBinding = env->lookup(varName);
+        auto result = values[0];
+        for (size_t i = 1; i < values.size(); i++){
+            result = builder->CreateBinOp(op.binaryOp(), result, values[i]);
+        }
+        return result;
+    }
 
-                    // Set value:
-                    return builder->CreateStore(value, varBinding);
-                }
+    /**
+     * Operator of an operator form, on operands (or vector lanes) of the
+     * given type (null if unknown: integers).
+     */
+    Operator operatorOf(const Exp& exp, llvm::Type* type){
+        const auto& op = operators[exp.list()[0].symbol->id];
+        checkOperands(exp, op);
+        return type != nullptr && type->getScalarType()->isFloatingPointTy() ? op.onFloats() : op;
+    }
+
+    /**
+     * Folds a constant expression at the AST level: a number, a boolean,
+     * or an operator form with constant operands. Returns null if the
+     * expression is not constant, or if folding it would hide a runtime
+     * error (a division by zero or overflow).
+     */
+    llvm::Constant* foldConstant(const Exp& exp){
+        switch (exp.type){
+            case ExpType::NUMBER:
+                return integerConstant(exp.number);
 
+            case ExpType::DECIMAL:
+                return llvm::ConstantFP::get(builder->getDoubleTy(), exp.decimal);
 
-                // ------------------------------------------
-                // Blocks: (begin <expressions>)
-                else if (op == "begin"){
-                    // Block scope:
-                    auto blockEnv = std::make_shared<Environment>(
-                        std::map<std::string, llvm::Value*>{}, env);
-
-                    // Compile each expression within the block.
-                    // Result is the last evaluated expression.
-                    llvm::Value* blockRes;
-                    for (auto i = 1; i < exp.list.size(); i++){
-                        // Generate expression code.
-                        blockRes = gen(exp.list[i], blockEnv); // TODO: local block env!
+            case ExpType::SYMBOL:
+                if (exp.isSymbol(trueSymbol) || exp.isSymbol(falseSymbol)){
+                    return builder->getInt1(exp.isSymbol(trueSymbol));
+                }
+                return nullptr;
+
+            case ExpType::LIST: {
+                const auto& items = exp.list();
+                const auto& tag = items[0];
+                if (tag.type != ExpType::SYMBOL || tag.symbol->id >= operators.size() ||
+                    !operators[tag.symbol->id].isDefined()){
+                    return nullptr;
+                }
+                auto type = llvmType(types->typeOf(exp));
+                auto op = operatorOf(exp, type);
+
+                llvm::Constant* result = nullptr;
+                for (size_t i = 1; i < items.size(); i++){
+                    auto operand = foldConstant(items[i]);
+                    if (operand == nullptr || !canConvert(operand, type)){
+                        return nullptr;
+                    }
+                    operand = llvm::cast<llvm::Constant>(convert(operand, type));
+                    if (result != nullptr && result->getType() != operand->getType()){
+                        return nullptr;
+                    }
+                    result = result == nullptr ? operand : foldBinary(op, result, operand);
+                    if (result == nullptr){
+                        return nullptr;
                     }
-                    return blockRes;    
                 }
 
-                // ------------------------------------------
-                // printf extern function:
-                //
-                // printf ("Value: %d" 42)
-                //
-
-                if (op == "printf") {
-                    auto printfFn = module->getFunction("printf");
-                    std::vector<llvm::Value*> args{};
-                    for (auto i = 1; i < exp.list.size(); i++)
-                    {
-                        args.push_back(gen(exp.list[i], env));
-                    }
-                    
-                    return builder->CreateCall(printfFn, args);
+                if (items.size() == 2 && op.opcode == llvm::Instruction::FSub){
+                    return llvm::ConstantExpr::getFNeg(result);
                 }
+                if (items.size() == 2 && op.opcode == llvm::Instruction::Sub){
+                    return llvm::ConstantExpr::getNeg(result);
+                }
+                return result;
+            }
+
+            default:
+                return nullptr;
+        }
+    }
+
+    /**
+     * Applies an operator to two constants, or returns null for an
+     * integer division by zero or an overflowing division.
+     */
+    llvm::Constant* foldBinary(const Operator& op, llvm::Constant* lhs, llvm::Constant* rhs){
+        if (op.isComparison()){
+            return llvm::ConstantExpr::getCompare(op.predicate, lhs, rhs);
+        }
+        if (op.opcode == llvm::Instruction::SDiv){
+            auto divisor = llvm::cast<llvm::ConstantInt>(rhs);
+            if (divisor->isZero() ||
+                (divisor->isMinusOne() &&
+                 llvm::cast<llvm::ConstantInt>(lhs)->isMinValue(/* isSigned */ true))){
+                return nullptr;
             }
         }
+        return llvm::ConstantExpr::get(op.opcode, lhs, rhs);
+    }
 
-        // just 42
-        //return builder->getInt32(42);
+    /**
+     * Checks the number of operands of an operator form.
+     */
+    void checkOperands(const Exp& exp, const Operator& op){
+        auto count = exp.list().size() - 1;
+        if (op.isComparison() ? count != 2 : count == 0){
+            DIE << "Operator " << exp.list()[0].string() << " expects "
+                << (op.isComparison() ? "2 operands" : "operands") << ", got "
+                << count << "\n";
+        }
+        // Division has no unary form, (/ x) is not 1/x.
+        if (op.opcode == llvm::Instruction::SDiv && count < 2){
+            DIE << "Operator " << exp.list()[0].string()
+                << " expects 2 or more operands, got " << count << "\n";
+        }
+    }
 
-        // string:
-        // return builder->CreateGlobalStringPtr("Hello World!\n");
-        // auto str = builder->CreateGlobalStringPtr("Hello World!\n");
+    /**
+     * Checks that two operands are numbers (or booleans, or vectors of
+     * them) of the same type.
+     */
+    void checkOperandTypes(const Exp& exp, llvm::Value* lhs, llvm::Value* rhs){
+        auto type = lhs->getType()->getScalarType();
+        if (!(type->isIntegerTy() || type->isFloatingPointTy()) ||
+            lhs->getType() != rhs->getType()){
+            DIE << "Operator " << exp.list()[0].string()
+                << " expects operands of the same numeric type\n";
+        }
+    }
 
-        // // call to printf
-        // auto printfFn = module->getFunction("printf");
+    /**
+     * Registers an operator: an arithmetic opcode, or an integer comparison
+     * (the f64 instruction is derived, see Operator::onFloats).
+     */
+    void registerOperator(std::string_view name, Operator op){
+        auto id = Keywords::intern(name);
+        if (id >= operators.size()){
+            operators.resize(id + 1);
+        }
+        operators[id] = op;
+        registerSpecialForm(name, &EvaLLVM::genOperator);
+    }
 
-        // // args
-        // std::vector<llvm::Value*> args{str};
+    /**
+     * Registers a special form handler under the keyword id of its name.
+     * New forms are added here instead of growing `gen`.
+     */
+    void registerSpecialForm(std::string_view name, SpecialForm handler){
+        auto id = Keywords::intern(name);
+        if (id >= specialForms.size()){
+            specialForms.resize(id + 1, nullptr);
+        }
+        specialForms[id] = handler;
+    }
 
-        // return builder->CreateCall(printfFn, args);
+    /**
+     * Registers a top-level form compiled as a unit of its own in
+     * parallel codegen, with the handler declaring its function.
+     */
+    void registerUnitForm(std::string_view name, UnitDeclaration declare){
+        auto id = Keywords::intern(name);
+        if (id >= unitForms.size()){
+            unitForms.resize(id + 1, nullptr);
+        }
+        unitForms[id] = declare;
+    }
 
-        //Unreachable
-        return builder->getInt32(0);
+    /**
+     * Sets up the special forms and keyword constants.
+     */
+    void setupSpecialForms(){
+        registerSpecialForm("var", &EvaLLVM::genVar);
+        registerSpecialForm("set", &EvaLLVM::genSet);
+        registerSpecialForm("begin", &EvaLLVM::genBegin);
+        registerSpecialForm("printf", &EvaLLVM::genPrintf);
+        registerSpecialForm("if", &EvaLLVM::genIf);
+        registerSpecialForm("while", &EvaLLVM::genWhile);
+        registerSpecialForm("def", &EvaLLVM::genDef);
+        registerUnitForm("def", &EvaLLVM::declareDef);
+
+        registerOperator("+", {llvm::Instruction::Add});
+        registerOperator("-", {llvm::Instruction::Sub});
+        registerOperator("*", {llvm::Instruction::Mul});
+        registerOperator("/", {llvm::Instruction::SDiv});
+        registerOperator("<", {llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SLT});
+        registerOperator(">", {llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SGT});
+        registerOperator("<=", {llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SLE});
+        registerOperator(">=", {llvm::Instruction::ICmp, llvm::CmpInst::ICMP_SGE});
+        registerOperator("==", {llvm::Instruction::ICmp, llvm::CmpInst::ICMP_EQ});
+        registerOperator("!=", {llvm::Instruction::ICmp, llvm::CmpInst::ICMP_NE});
+
+        registerSpecialForm("extract", &EvaLLVM::genExtract);
+        registerSpecialForm("insert", &EvaLLVM::genInsert);
+        registerSpecialForm("shuffle", &EvaLLVM::genShuffle);
+        registerSpecialForm("reduce", &EvaLLVM::genReduce);
+        registerSpecialForm("get", &EvaLLVM::genGet);
+        registerSpecialForm("put", &EvaLLVM::genPut);
+        registerSpecialForm("len", &EvaLLVM::genLen);
+
+        trueSymbol = Keywords::intern("true");
+        falseSymbol = Keywords::intern("false");
+        vecSymbol = Keywords::intern("vec");
+        arraySymbol = Keywords::intern("array");
+        setSymbol = Keywords::intern("set");
+        restrictSymbol = Keywords::intern("restrict");
+        arrowSymbol = Keywords::intern("->");
+    }
+
+    /**
+     * Whether a var declaration is a name, or (name type).
+     */
+    static bool isVarDecl(const Exp& exp){
+        if (exp.type == ExpType::LIST){
+            return exp.list().size() == 2 && exp.list()[0].type == ExpType::SYMBOL;
+        }
+        return exp.type == ExpType::SYMBOL;
     }
 
     /**
@@ -231,7 +3086,8 @@ private:
      * (x number)-> x
      */
     std::string extractVarName(const Exp& exp){
-        return exp.type == ExpType::LIST ? exp.list[0].string : exp.string;
+        return std::string(exp.type == ExpType::LIST ? exp.list()[0].string()
+                                                     : exp.string());
     }
 
     /**
@@ -239,35 +3095,176 @@ private:
      * 
      * x -> i32
      * (x number)-> number
+     * (v (vec 8 f32)) -> <8 x float>
      */
     llvm::Type* extractVarType(const Exp& exp){
-        return exp.type == ExpType::LIST ? getTypefromString(exp.list[1].string)
+        return exp.type == ExpType::LIST ? getTypefromExp(exp.list()[1])
                                          : builder->getInt32Ty();    
     }
 
     /**
-     * Return LLVM type from string representation.
+     * Return LLVM type of a type annotation: a type name, or a vector or
+     * an array of i32, i64, f32 or f64.
+     *
+     * (vec 8 f32) -> <8 x float>
+     * (array 100 f64), (array f64) -> { double*, i64 }
      */
-    llvm::Type* getTypefromString(const std::string& type_){
-        // number -> i32
-        if(type_ == "number"){
-            return builder-> getInt32Ty();
+    llvm::Type* getTypefromExp(const Exp& type_){
+        if (type_.type != ExpType::LIST){
+            return getTypefromString(type_.string());
+        }
+
+        const auto& items = type_.list();
+        if (!items.empty() && items[0].isSymbol(arraySymbol)){
+            const auto& elementName = items[items.size() - 1];
+            auto element = elementName.type != ExpType::SYMBOL ? nullptr
+                           : elementName.string() == "f32"
+                               ? builder->getFloatTy()
+                               : llvmType(typeFromName(elementName.string()));
+            if ((items.size() != 2 && items.size() != 3) || element == nullptr ||
+                element->isIntegerTy(1) || element->isPointerTy()){
+                DIE << "Array type expects (array [<length>] <element type>), "
+                    << "with i32, i64, f32 or f64 elements\n";
+            }
+            return llvm::StructType::get(element->getPointerTo(), builder->getInt64Ty());
         }
 
-        // string -> i8* (aka char*)
-        if (type_ == "string"){
-            return builder->getInt8Ty()->getPointerTo();
+        if (items.size() != 3 || !items[0].isSymbol(vecSymbol) ||
+            items[1].type != ExpType::NUMBER || items[1].number <= 0 ||
+            items[1].number > MAX_VECTOR_LANES || items[2].type != ExpType::SYMBOL){
+            DIE << "Vector type expects (vec <lanes> <element type>), with up to "
+                << MAX_VECTOR_LANES << " lanes\n";
         }
 
+        auto elementName = items[2].string();
+        auto element = elementName == "f32" ? builder->getFloatTy()
+                                            : llvmType(typeFromName(elementName));
+        if (element == nullptr || element->isIntegerTy(1) || element->isPointerTy()){
+            DIE << "Vector elements must be i32, i64, f32 or f64\n";
+        }
+        return llvm::FixedVectorType::get(element, items[1].number);
+    }
+
+    /**
+     * Most lanes of a vector type (a 4096-bit vector of i64).
+     */
+    static constexpr int64_t MAX_VECTOR_LANES = 64;
+
+    /**
+     * Return LLVM type from string representation.
+     */
+    llvm::Type* getTypefromString(std::string_view type_){
+        // number -> i32, i64, f64, bool -> i1, string -> i8* (aka char*)
+        auto type = llvmType(typeFromName(type_));
+
         // default
-        return builder->getInt32Ty();
+        return type != nullptr ? type : builder->getInt32Ty();
+    }
+
+    /**
+     * LLVM type of an inferred type, null if it has no value type.
+     */
+    llvm::Type* llvmType(EvaType type){
+        switch (type){
+            case EvaType::Bool: return builder->getInt1Ty();
+            case EvaType::I32: return builder->getInt32Ty();
+            case EvaType::I64: return builder->getInt64Ty();
+            case EvaType::F64: return builder->getDoubleTy();
+            case EvaType::String: return builder->getInt8Ty()->getPointerTo();
+            default: return nullptr;
+        }
+    }
+
+    /**
+     * Inferred type of a form, or the fallback if it has none.
+     */
+    llvm::Type* inferredType(const Exp& exp, llvm::Type* fallback){
+        auto type = llvmType(types->typeOf(exp));
+        return type != nullptr ? type : fallback;
+    }
+
+    /**
+     * Integer literal: i32 if it fits, i64 otherwise.
+     */
+    llvm::Constant* integerConstant(int64_t number){
+        if (number >= INT32_MIN && number <= INT32_MAX){
+            return builder->getInt32(number);
+        }
+        return builder->getInt64(number);
+    }
+
+    /**
+     * Whether a value converts to a type: to its own type, widening a
+     * number (i1 < i32 < i64 < f64, f32 < f64), or a scalar to every lane
+     * of a vector. Decimal literals also round to f32. A null target
+     * keeps the value's type.
+     */
+    bool canConvert(llvm::Value* value, llvm::Type* to){
+        auto from = value->getType();
+        if (to == nullptr || from == to){
+            return true;
+        }
+        if (auto vector = llvm::dyn_cast<llvm::FixedVectorType>(to)){
+            return !from->isVectorTy() && canConvert(value, vector->getElementType());
+        }
+        if (from->isDoubleTy()){
+            return to->isFloatTy() && llvm::isa<llvm::ConstantFP>(value);
+        }
+        if (from->isFloatTy()){
+            return to->isDoubleTy();
+        }
+        if (!from->isIntegerTy()){
+            return false;
+        }
+        return to->isFloatingPointTy() ||
+               (to->isIntegerTy() && to->getIntegerBitWidth() > from->getIntegerBitWidth());
+    }
+
+    /**
+     * Converts a value to a type (see canConvert). Booleans are unsigned,
+     * other integers signed.
+     */
+    llvm::Value* convert(llvm::Value* value, llvm::Type* type){
+        auto from = value->getType();
+        if (!canConvert(value, type)){
+            DIE << "Cannot convert a value to a narrower or unrelated type\n";
+        }
+        if (type == nullptr || from == type){
+            return value;
+        }
+        if (auto vector = llvm::dyn_cast<llvm::FixedVectorType>(type)){
+            return builder->CreateVectorSplat(vector->getNumElements(),
+                                              convert(value, vector->getElementType()));
+        }
+        if (from->isFloatingPointTy()){
+            return builder->CreateFPCast(value, type);
+        }
+        auto isBool = from->isIntegerTy(1);
+        if (type->isFloatingPointTy()){
+            return isBool ? builder->CreateUIToFP(value, type) : builder->CreateSIToFP(value, type);
+        }
+        return isBool ? builder->CreateZExt(value, type) : builder->CreateSExt(value, type);
+    }
+
+    /**
+     * Positions the vars builder at the end of the entry block of a
+     * function, where its stack slots are allocated. The entry block may
+     * already end in a branch: stay before it.
+     */
+    void setVarsInsertPoint(llvm::Function* function){
+        auto& entry = function->getEntryBlock();
+        if (auto terminator = entry.getTerminator()){
+            varsBuilder->SetInsertPoint(terminator);
+        } else {
+            varsBuilder->SetInsertPoint(&entry);
+        }
     }
 
     /**
      *  Allocates a local variable on the stack. Result is the alloca instruction.
      */
     llvm::Value* allocVar(const std::string& name, llvm::Type* type_, Env env){
-        varsBuilder->SetInsertPoint(&fn->getEntryBlock());
+        setVarsInsertPoint(fn);
 
         auto varAlloc = varsBuilder->CreateAlloca(type_, 0, name.c_str());
 
@@ -289,6 +3286,14 @@ private:
         variable->setInitializer(init);
         return variable;
     }
+    /**
+     * Declares a global variable defined in another module.
+     */
+    llvm::GlobalVariable* declareGlobalVar(const std::string& name, llvm::Type* type){
+        module->getOrInsertGlobal(name, type);
+        return module->getNamedGlobal(name);
+    }
+
     /* define external function from libc++ for printf */
     void setupExternalFunctions() {
         // i8* to substitude for char*, void*, etc 
@@ -318,11 +3323,22 @@ private:
         return fn;
     }
 
+    /**
+     * Checks a generated function: invalid IR is a compiler error, with
+     * the verifier's report printed first.
+     */
+    void verifyGenerated(llvm::Function& function){
+        if (llvm::verifyFunction(function, &llvm::errs())){
+            DIE << "Invalid code generated for function \"" << function.getName().str()
+                << "\"\n";
+        }
+    }
+
     llvm::Function* createFunctionProto(const std::string& fnName, llvm::FunctionType* fnType, Env env){
 
         auto fn = llvm::Function::Create(fnType, llvm::Function::ExternalLinkage, fnName, *module);
 
-        verifyFunction(*fn);
+        verifyGenerated(*fn);
 
         // Install in the enviornment:
         env->define(fnName, fn);
@@ -336,19 +3352,70 @@ private:
     }
 
     llvm::BasicBlock* createBB(std::string name, llvm::Function* fn = nullptr) {
-        return llvm::BasicBlock::Create(*ctx, name, fn);
+        return llvm::BasicBlock::Create(module->getContext(), name, fn);
     }
 
     void saveModuleToFile(const std :: string& fileName) {
         std::error_code errorCode;
-        llvm::raw_fd_ostream outLL(fileName, errorCode);
-        module->print(outLL, nullptr); 
+        auto flags = options.outputFormat == OutputFormat::Bitcode
+                         ? llvm::sys::fs::OF_None
+                         : llvm::sys::fs::OF_Text;
+        llvm::raw_fd_ostream out(fileName, errorCode, flags);
+        if (errorCode){
+            DIE << "Cannot open " << fileName << ": " << errorCode.message() << "\n";
+        }
+        writeModule(out);
+    }
+
+    /**
+     * Creates the target machine of the host. It sets the module's
+     * triple and data layout, drives target-aware optimizations and
+     * emits native code.
+     */
+    void setupTargetMachine() {
+        static std::once_flag targetInit;
+        std::call_once(targetInit, [](){
+            llvm::InitializeNativeTarget();
+            llvm::InitializeNativeTargetAsmPrinter();
+        });
+
+        auto triple = llvm::sys::getDefaultTargetTriple();
+
+        std::string error;
+        auto target = llvm::TargetRegistry::lookupTarget(triple, error);
+        if (target == nullptr){
+            DIE << "Unsupported host target " << triple << ": " << error << "\n";
+        }
+
+        llvm::SubtargetFeatures features;
+        llvm::StringMap<bool> hostFeatures;
+        if (llvm::sys::getHostCPUFeatures(hostFeatures)){
+            for (auto& feature : hostFeatures){
+                features.AddFeature(feature.first(), feature.second);
+            }
+        }
+
+        static const llvm::CodeGenOpt::Level codegenLevels[] = {
+            llvm::CodeGenOpt::None, llvm::CodeGenOpt::Less,
+            llvm::CodeGenOpt::Default, llvm::CodeGenOpt::Aggressive,
+        };
+
+        // PIC, so the object links into position-independent executables.
+        targetMachine.reset(target->createTargetMachine(
+            triple, llvm::sys::getHostCPUName(), features.getString(),
+            llvm::TargetOptions(), llvm::Reloc::PIC_, llvm::None,
+            codegenLevels[std::min(options.optLevel, 3u)]));
     }
 
     void moduleInit() {
         // Open a new context and module.
         ctx = std::make_unique<llvm::LLVMContext>();
         module = std::make_unique<llvm::Module>("EvaLLVM", *ctx);
+        // Target the host.
+        module->setTargetTriple(targetMachine->getTargetTriple().str());
+        module->setDataLayout(targetMachine->createDataLayout());
+        // Literals of the previous module.
+        stringLiterals.clear();
         // Create a new builder for the module.
         builder = std::make_unique<llvm::IRBuilder<>>(*ctx);
         // Vars builder:
@@ -365,13 +3432,143 @@ private:
         std::map<std::string, llvm::Value*> globalRec{};
         
         for (auto& entry : globalObject){
-            globalRec[entry.first] = 
-                createGlobalVar(entry.first, (llvm::Constant*)entry.second);
+            globalRec[entry.first] = isUnit
+                ? declareGlobalVar(entry.first, entry.second->getType())
+                : createGlobalVar(entry.first, (llvm::Constant*)entry.second);
         }
 
         GlobalEnv = std::make_shared<Environment>(globalRec, nullptr);
     }
 
+    /**
+     * Compiler options.
+     */
+    EvaOptions options;
+
+    /**
+     * Whether this compiles a single unit of a parallel compilation.
+     */
+    bool isUnit;
+
+    /**
+     * Unit form declarations, indexed by keyword id.
+     */
+    std::vector<UnitDeclaration> unitForms;
+
+    /**
+     * Modules of the units compiled in parallel, not linked yet.
+     */
+    std::vector<llvm::orc::ThreadSafeModule> unitModules;
+
+    /**
+     * Units left to compile on first call in lazy JIT mode, their forms
+     * by function name, and the units `main` refers to.
+     */
+    std::vector<const Exp*> lazyUnits;
+    llvm::StringMap<const Exp*> lazyUnitForms;
+
+    /**
+     * Lazy units compiled when a caller is linked instead, see
+     * addLazyUnits.
+     */
+    llvm::StringSet<> eagerUnits;
+    std::vector<std::string> mainCallees;
+
+    /**
+     * Speculative unit objects not taken yet by a call, and the units
+     * ever speculated.
+     */
+    std::mutex speculationMutex;
+    std::map<std::string, std::future<std::unique_ptr<llvm::MemoryBuffer>>> speculations;
+    llvm::StringSet<> speculated;
+
+    /**
+     * Time taken by the last optimization pipeline.
+     */
+    std::chrono::duration<double> optimizationTime_{};
+
+    /**
+     * Worker threads.
+     */
+    std::unique_ptr<ThreadPool> pool;
+
+    /**
+     * Host target machine.
+     */
+    std::unique_ptr<llvm::TargetMachine> targetMachine;
+
+    /**
+     * Compilation cache, and the key of the program being compiled
+     * (empty if it is not cached).
+     */
+    std::unique_ptr<CompileCache> cache;
+    std::string cacheKey_;
+
+    /**
+     * Whether the module was loaded from the cache.
+     */
+    bool moduleFromCache_ = false;
+
+    /**
+     * String literal pool of the module: decoded contents to global.
+     */
+    llvm::StringMap<llvm::Constant*> stringLiterals;
+
+    /**
+     * Special form handlers, indexed by keyword id.
+     */
+    std::vector<SpecialForm> specialForms;
+
+    /**
+     * Operators, indexed by keyword id.
+     */
+    std::vector<Operator> operators;
+
+    /**
+     * Types of the program, inferred before it is generated, shared with
+     * the unit compilers.
+     */
+    std::shared_ptr<TypeInference> types = std::make_shared<TypeInference>();
+
+    /**
+     * Keyword ids of the boolean constants.
+     */
+    uint32_t trueSymbol;
+    uint32_t falseSymbol;
+
+    /**
+     * Keyword ids of vector and array types, (vec 8 f32) and
+     * (array 100 f64), of set, of the restrict annotation, and of the
+     * arrow before the return type of a def.
+     */
+    uint32_t vecSymbol;
+    uint32_t arraySymbol;
+    uint32_t setSymbol;
+    uint32_t restrictSymbol;
+    uint32_t arrowSymbol;
+
+    /**
+     * Alias scopes of the array parameters of the def being generated,
+     * by parameter variable, see scopeArrayParams.
+     */
+    struct ArrayScope {
+        llvm::MDNode* scope;
+        llvm::MDNode* noalias;
+    };
+    std::map<llvm::Value*, ArrayScope> arrayScopes;
+
+    /**
+     * Slots of the heap arrays owned by each scope not ended yet, see
+     * ownHeapArray.
+     */
+    std::map<const Environment*, std::vector<llvm::Value*>> heapArrays;
+
+    /**
+     * Scopes not ended yet that allocate arrays, on the stack or the
+     * heap: their arrays must not outlive them.
+     */
+    std::set<const Environment*> arrayOwners;
+
     /**
      * Parser.
     */
@@ -387,6 +3584,34 @@ private:
      */
     llvm::Function* fn;
 
+    /**
+     * A global of an earlier session input: its symbol, its value type (a
+     * function type for functions), and a function's calling convention.
+     */
+    struct SessionGlobal {
+        std::string symbol;
+        llvm::Type* type;
+        llvm::CallingConv::ID callingConv = llvm::CallingConv::C;
+    };
+
+    /**
+     * Session: the JIT running the inputs, the context shared by their
+     * modules, the globals they defined by name in the global
+     * environment, the symbols taken, and the number of inputs so far.
+     */
+    std::unique_ptr<llvm::orc::LLJIT> session;
+    llvm::orc::ThreadSafeContext sessionContext;
+    std::map<std::string, SessionGlobal> sessionGlobals;
+    llvm::StringSet<> sessionSymbols;
+    unsigned sessionInputs = 0;
+
+    /**
+     * Stubs of the functions of the session, and the resource tracker of
+     * the code each stub points to, by symbol.
+     */
+    std::unique_ptr<llvm::orc::IndirectStubsManager> sessionStubs;
+    std::map<std::string, llvm::orc::ResourceTrackerSP> sessionDefs;
+
     // Global LLVM context.
     // It owns and manages the core "global" data of LLVM's core infrastructure,
     // including the type and constant unique tables.
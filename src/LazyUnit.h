@@ -0,0 +1,49 @@
+/**
+ * ORC materialization unit of a function compiled on first use.
+ */
+
+#ifndef LazyUnit_h
+#define LazyUnit_h
+
+#include <functional>
+#include <memory>
+#include <string>
+
+#include "llvm/ExecutionEngine/Orc/Core.h"
+
+/**
+ * Defines a single function symbol in a JITDylib without compiling it.
+ *
+ * The JIT materializes the unit the first time the symbol is looked up:
+ * by a lazy re-export stub on the function's first call, or by a
+ * speculative lookup. `materialize` then generates the function's
+ * module and emits it for the responsibility.
+ */
+class LazyUnit : public llvm::orc::MaterializationUnit {
+public:
+    using Materializer =
+        std::function<void(std::unique_ptr<llvm::orc::MaterializationResponsibility>)>;
+
+    LazyUnit(std::string name, llvm::orc::SymbolStringPtr symbol, Materializer materializer)
+        : MaterializationUnit(Interface(
+              llvm::orc::SymbolFlagsMap{
+                  {symbol, llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable}},
+              nullptr)),
+          name_(std::move(name)), materializer_(std::move(materializer)) {}
+
+    llvm::StringRef getName() const override { return name_; }
+
+private:
+    void materialize(std::unique_ptr<llvm::orc::MaterializationResponsibility> responsibility) override {
+        materializer_(std::move(responsibility));
+    }
+
+    // A unit defines its symbol only, there is nothing else to drop.
+    void discard(const llvm::orc::JITDylib&, const llvm::orc::SymbolStringPtr&) override {}
+
+    std::string name_;
+
+    Materializer materializer_;
+};
+
+#endif
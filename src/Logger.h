@@ -5,14 +5,49 @@
 #ifndef Logger_h
 #define Logger_h
 
-class ErrorLogMessage : public std::basic_ostringstream<char> {
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+/**
+ * Error reported by DIE while errors are recoverable.
+ */
+class CompileError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+class ErrorLogMessage {
 public:
-    ~ErrorLogMessage(){
-        std::cerr << "Fatal error: " << str().c_str();
+    /**
+     * Whether an error throws a CompileError instead of exiting, so that
+     * an interactive session survives it. Per thread: set by the thread
+     * evaluating the session's inputs, errors of other threads (codegen
+     * and parse workers) still exit.
+     */
+    static inline thread_local bool recoverable = false;
+
+    template <typename T>
+    ErrorLogMessage& operator<<(const T& value){
+        message_ << value;
+        return *this;
+    }
+
+    ~ErrorLogMessage() noexcept(false) {
+        if (recoverable && std::uncaught_exceptions() == 0){
+            std::cerr << "Error: " << message_.str();
+            throw CompileError(message_.str());
+        }
+        std::cerr << "Fatal error: " << message_.str();
         exit(EXIT_FAILURE);
     }
+
+private:
+    std::ostringstream message_;
 };
 
 #define DIE ErrorLogMessage()
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,774 @@
+/**
+ * Static type inference for Eva programs.
+ */
+
+#ifndef TypeInference_h
+#define TypeInference_h
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "parser/EvaAst.h"
+
+/**
+ * Types of Eva values.
+ */
+enum class EvaType : unsigned char {
+    // Not known yet, e.g. the result of a function still being inferred.
+    // Unifies with any type.
+    Unknown,
+
+    // No value: a store, or if branches of unrelated types.
+    Void,
+
+    Bool,
+
+    // Numeric types, from the narrowest.
+    I32,
+    I64,
+    F64,
+
+    String,
+
+    Function,
+
+    // SIMD vectors and arrays: their shape is not inferred, codegen takes
+    // the type of the annotation or of the value. So are their lanes and
+    // elements, unless the annotation gives an inferred type (i64, not
+    // f32). Unifies with any type.
+    Opaque,
+};
+
+/**
+ * Type of a type annotation: number (i32), i32, i64, f64, bool or
+ * string. Unknown for other names.
+ */
+inline EvaType typeFromName(std::string_view name) {
+    if (name == "number" || name == "i32") return EvaType::I32;
+    if (name == "i64") return EvaType::I64;
+    if (name == "f64") return EvaType::F64;
+    if (name == "bool") return EvaType::Bool;
+    if (name == "string") return EvaType::String;
+    return EvaType::Unknown;
+}
+
+inline bool isNumeric(EvaType type) {
+    return type >= EvaType::I32 && type <= EvaType::F64;
+}
+
+/**
+ * Type of a value that may have either type: the wider of two numeric
+ * types (i32 < i64 < f64), the other one if a type is Unknown, Void if
+ * they are unrelated.
+ */
+inline EvaType unify(EvaType a, EvaType b) {
+    if (a == EvaType::Unknown) return b;
+    if (b == EvaType::Unknown || a == b) return a;
+    if (a == EvaType::Opaque || b == EvaType::Opaque) return EvaType::Opaque;
+    if (isNumeric(a) && isNumeric(b)) return std::max(a, b);
+    return EvaType::Void;
+}
+
+/**
+ * Type of a variable or parameter. An annotated type is fixed, an
+ * inferred one widens to every value stored in it. An array or vector
+ * annotation also gives the type of the elements.
+ */
+struct TypeSlot {
+    EvaType type = EvaType::Unknown;
+    bool annotated = false;
+    EvaType element = EvaType::Unknown;
+};
+
+/**
+ * Inferred signature of a function.
+ */
+struct Signature {
+    std::vector<TypeSlot> params;
+    TypeSlot result;
+};
+
+/**
+ * Infers the types of variables, operators, if expressions and function
+ * signatures before codegen, so that `gen` emits instructions of the
+ * exact width and literals of the operand type, with no casts.
+ *
+ * Numbers are i32 if they fit, i64 otherwise, and decimals f64. Numeric
+ * operands unify to the widest of them. Unannotated variables take the
+ * type of every value assigned to them, unannotated parameters the type
+ * of every argument passed at a call site, and return types the type of
+ * the body. These depend on each other (through recursion, or a call
+ * before a `set`), so a unit is inferred again until no type changes.
+ * Types only widen, so this takes a few passes. Types still unknown at
+ * the end default to i32.
+ *
+ * Results are keyed by the children span of a form, which copies of the
+ * form share.
+ */
+class TypeInference {
+public:
+    TypeInference() {
+        registerRule("var", &TypeInference::inferVar);
+        registerRule("set", &TypeInference::inferSet);
+        registerRule("begin", &TypeInference::inferBegin);
+        registerRule("if", &TypeInference::inferIf);
+        registerRule("while", &TypeInference::inferWhile);
+        registerRule("printf", &TypeInference::inferPrintf);
+        registerRule("def", &TypeInference::inferDef);
+
+        for (auto name : {"extract", "insert", "shuffle", "reduce"}) {
+            registerRule(name, &TypeInference::inferVectorForm);
+        }
+        registerRule("get", &TypeInference::inferElement);
+        registerRule("put", &TypeInference::inferElement);
+        registerRule("len", &TypeInference::inferLen);
+
+        for (auto name : {"+", "-", "*", "/"}) {
+            registerRule(name, &TypeInference::inferArithmetic);
+        }
+        for (auto name : {"<", ">", "<=", ">=", "==", "!="}) {
+            registerRule(name, &TypeInference::inferComparison);
+        }
+
+        trueSymbol_ = Keywords::intern("true");
+        falseSymbol_ = Keywords::intern("false");
+        arrowSymbol_ = Keywords::intern("->");
+        extractSymbol_ = Keywords::intern("extract");
+        reduceSymbol_ = Keywords::intern("reduce");
+
+        // Builtin globals.
+        rootSlots_.push_back({EvaType::I32, /* annotated */ true});
+        root_.bindings["VERSION"] = {&rootSlots_.back(), nullptr};
+    }
+
+    /**
+     * Infers the types of a compilation unit: forms compiled in the top
+     * level scope, which is kept across units (the forms of a stream, or
+     * the inputs of a session). Results of the previous unit are dropped.
+     */
+    void infer(const Exp* forms, size_t count) {
+        types_.clear();
+        signatures_.clear();
+        unitRootNames_.clear();
+
+        // Top level bindings of a program take the same slots every pass.
+        auto programSlotsUsed = programSlotsUsed_;
+        auto programSignaturesUsed = programSignaturesUsed_;
+
+        for (auto pass = 0; pass < MAX_PASSES; pass++) {
+            changed_ = false;
+            programSlotsUsed_ = programSlotsUsed;
+            programSignaturesUsed_ = programSignaturesUsed;
+            unitProgramForms_.clear();
+            unitProgramDefs_.clear();
+            for (size_t i = 0; i < count; i++) {
+                infer(forms[i], root_);
+            }
+            if (!changed_) {
+                break;
+            }
+        }
+
+        for (auto& entry : types_) {
+            defaultToI32(entry.second);
+        }
+        for (auto& entry : signatures_) {
+            for (auto& param : entry.second.params) {
+                defaultToI32(param);
+            }
+            defaultToI32(entry.second.result);
+        }
+
+        if (inProgram_) {
+            for (auto& entry : unitProgramForms_) {
+                types_[entry.first] = *entry.second;
+            }
+            for (auto& entry : unitProgramDefs_) {
+                signatures_[entry.first] = *entry.second;
+            }
+            unitProgramForms_.clear();
+            unitProgramDefs_.clear();
+        } else {
+            detachRootBindings();
+        }
+    }
+
+    /**
+     * Starts inferring a program read form by form, as a stream: top level
+     * bindings are typed by the whole program, as if it was inferred at
+     * once, while each form is still inferred (and compiled) on its own.
+     *
+     * The program is inferred in passes over its forms, each form with
+     * `infer`, between beginProgramPass and endProgramPass, until the top
+     * level types stop changing. The forms are then inferred once more for
+     * codegen, in a last pass with these types fixed.
+     */
+    void beginProgram() {
+        inProgram_ = true;
+        programSlots_.clear();
+        programSignatures_.clear();
+        programRoot_ = root_.bindings;
+        programPasses_ = 0;
+    }
+
+    /**
+     * Starts a pass over the forms of the program, from the first one.
+     */
+    void beginProgramPass() {
+        root_.bindings = programRoot_;
+        programSlotsUsed_ = 0;
+        programSignaturesUsed_ = 0;
+        programSnapshot_ = programTypes();
+    }
+
+    /**
+     * Ends a pass over the forms of the program. Returns whether a top
+     * level type changed, so another pass is needed. Otherwise the types
+     * are fixed, as in a unit.
+     */
+    bool endProgramPass() {
+        if (programTypes() != programSnapshot_ && ++programPasses_ < MAX_PASSES) {
+            return true;
+        }
+
+        for (auto& slot : programSlots_) {
+            defaultToI32(slot);
+            slot.annotated = true;
+        }
+        for (auto& signature : programSignatures_) {
+            for (auto& param : signature.params) {
+                defaultToI32(param);
+                param.annotated = true;
+            }
+            defaultToI32(signature.result);
+            signature.result.annotated = true;
+        }
+        return false;
+    }
+
+    /**
+     * Ends the program, and drops its top level bindings.
+     */
+    void endProgram() {
+        inProgram_ = false;
+        root_.bindings = std::move(programRoot_);
+        programRoot_.clear();
+        programSlots_.clear();
+        programSignatures_.clear();
+    }
+
+    /**
+     * Inferred type of a form: the variable of a var, the value of an if,
+     * the operands of an operator. Unknown for other forms.
+     */
+    EvaType typeOf(const Exp& form) const {
+        if (form.type != ExpType::LIST) {
+            return EvaType::Unknown;
+        }
+        auto found = types_.find(form.items);
+        return found == types_.end() ? EvaType::Unknown : found->second.type;
+    }
+
+    /**
+     * Inferred signature of a def, null if the def was not inferred.
+     */
+    const Signature* signatureOf(const Exp& def) const {
+        auto found = signatures_.find(def.items);
+        return found == signatures_.end() ? nullptr : &found->second;
+    }
+
+private:
+    /**
+     * Passes over a unit are bounded, in case of a bug in widening.
+     */
+    static constexpr int MAX_PASSES = 16;
+
+    /**
+     * A name in scope: a variable or parameter, or a function.
+     */
+    struct Binding {
+        TypeSlot* slot;
+        Signature* signature;
+    };
+
+    /**
+     * Names bound in a scope. Lookups take the name as a view, with no
+     * copy: ids of symbols other than keywords differ between the
+     * AstContexts of the units.
+     */
+    using Bindings = std::map<std::string, Binding, std::less<>>;
+
+    struct Scope {
+        Bindings bindings;
+        Scope* parent = nullptr;
+
+        Binding* lookup(std::string_view name) {
+            for (auto scope = this; scope != nullptr; scope = scope->parent) {
+                auto found = scope->bindings.find(name);
+                if (found != scope->bindings.end()) {
+                    return &found->second;
+                }
+            }
+            return nullptr;
+        }
+    };
+
+    /**
+     * Inference rule of a special form.
+     */
+    using Rule = EvaType (TypeInference::*)(const Exp&, Scope&);
+
+    void registerRule(std::string_view name, Rule rule) {
+        auto id = Keywords::intern(name);
+        if (id >= rules_.size()) {
+            rules_.resize(id + 1, nullptr);
+        }
+        rules_[id] = rule;
+    }
+
+    EvaType infer(const Exp& exp, Scope& scope) {
+        switch (exp.type) {
+            case ExpType::NUMBER:
+                return exp.number >= std::numeric_limits<int32_t>::min() &&
+                               exp.number <= std::numeric_limits<int32_t>::max()
+                           ? EvaType::I32
+                           : EvaType::I64;
+
+            case ExpType::DECIMAL:
+                return EvaType::F64;
+
+            case ExpType::STRING:
+                return EvaType::String;
+
+            case ExpType::SYMBOL: {
+                if (exp.isSymbol(trueSymbol_) || exp.isSymbol(falseSymbol_)) {
+                    return EvaType::Bool;
+                }
+                auto binding = scope.lookup(exp.string());
+                if (binding == nullptr) {
+                    return EvaType::Unknown;
+                }
+                return binding->slot != nullptr ? binding->slot->type : EvaType::Function;
+            }
+
+            case ExpType::LIST: {
+                if (exp.list().empty()) {
+                    return EvaType::Unknown;
+                }
+                const auto& tag = exp.list()[0];
+                if (tag.type == ExpType::SYMBOL && tag.symbol->id < rules_.size() &&
+                    rules_[tag.symbol->id] != nullptr) {
+                    return (this->*rules_[tag.symbol->id])(exp, scope);
+                }
+                return inferCall(exp, scope);
+            }
+        }
+        return EvaType::Unknown;
+    }
+
+    // (var x 42), (var (x i64) 42)
+    EvaType inferVar(const Exp& exp, Scope& scope) {
+        if (exp.list().size() != 3) {
+            return EvaType::Void;
+        }
+        const auto& decl = exp.list()[1];
+        auto& slot = &scope == &root_ && inProgram_ ? programSlotOf(exp) : slotOf(exp);
+        if (decl.type == ExpType::LIST && decl.list().size() == 2) {
+            annotate(slot, decl.list()[1]);
+        }
+
+        // The initializer is in the outer scope of the variable.
+        widen(slot, infer(exp.list()[2], scope));
+        bind(scope, decl.type == ExpType::LIST ? decl.list()[0] : decl, {&slot, nullptr});
+        return EvaType::Void;
+    }
+
+    // (set x 100)
+    EvaType inferSet(const Exp& exp, Scope& scope) {
+        if (exp.list().size() != 3) {
+            return EvaType::Void;
+        }
+        auto type = infer(exp.list()[2], scope);
+        auto binding = scope.lookup(exp.list()[1].string());
+        if (binding != nullptr && binding->slot != nullptr) {
+            widen(*binding->slot, type);
+        }
+        return EvaType::Void;
+    }
+
+    // (begin <expressions>)
+    EvaType inferBegin(const Exp& exp, Scope& scope) {
+        Scope blockScope;
+        blockScope.parent = &scope;
+        auto type = EvaType::I32;
+        for (size_t i = 1; i < exp.list().size(); i++) {
+            type = infer(exp.list()[i], blockScope);
+        }
+        return type;
+    }
+
+    // (if <cond> <then> <else>)
+    EvaType inferIf(const Exp& exp, Scope& scope) {
+        const auto& items = exp.list();
+        if (items.size() != 3 && items.size() != 4) {
+            return EvaType::I32;
+        }
+        infer(items[1], scope);
+        auto thenType = infer(items[2], scope);
+        auto elseType = items.size() == 4 ? infer(items[3], scope) : EvaType::I32;
+
+        auto type = thenType == EvaType::Void || elseType == EvaType::Void
+                        ? EvaType::Void
+                        : unify(thenType, elseType);
+        set(slotOf(exp), type);
+
+        // Branches without a common type give 0.
+        return type == EvaType::Void ? EvaType::I32 : type;
+    }
+
+    // (while <cond> <body>...)
+    EvaType inferWhile(const Exp& exp, Scope& scope) {
+        for (size_t i = 1; i < exp.list().size(); i++) {
+            infer(exp.list()[i], scope);
+        }
+        return EvaType::I32;
+    }
+
+    // (printf <format> <args>...)
+    EvaType inferPrintf(const Exp& exp, Scope& scope) {
+        for (size_t i = 1; i < exp.list().size(); i++) {
+            infer(exp.list()[i], scope);
+        }
+        return EvaType::I32;
+    }
+
+    // (+ x 1): the operands and the result have the widest operand type.
+    EvaType inferArithmetic(const Exp& exp, Scope& scope) {
+        return inferOperands(exp, scope);
+    }
+
+    // (< x 1): the operands have the widest operand type. Vectors compare
+    // lane by lane.
+    EvaType inferComparison(const Exp& exp, Scope& scope) {
+        return inferOperands(exp, scope) == EvaType::Opaque ? EvaType::Opaque
+                                                            : EvaType::Bool;
+    }
+
+    EvaType inferOperands(const Exp& exp, Scope& scope) {
+        auto type = EvaType::Unknown;
+        for (size_t i = 1; i < exp.list().size(); i++) {
+            auto operand = infer(exp.list()[i], scope);
+            type = isNumeric(operand) || operand == EvaType::Unknown ||
+                           operand == EvaType::Opaque
+                       ? unify(type, operand)
+                       : EvaType::Void;
+            if (type == EvaType::Void) {
+                break;
+            }
+        }
+        set(slotOf(exp), type);
+        return type;
+    }
+
+    // (def name (params) [-> type] body)
+    EvaType inferDef(const Exp& exp, Scope& scope) {
+        const auto& items = exp.list();
+        if (items.size() < 4 || items[2].type != ExpType::LIST) {
+            return EvaType::Function;
+        }
+
+        const auto& params = items[2].list();
+        auto hasReturnType = items[3].isSymbol(arrowSymbol_);
+        auto bodyIndex = hasReturnType ? 5u : 3u;
+        if (items.size() != bodyIndex + 1) {
+            return EvaType::Function;
+        }
+
+        auto& signature =
+            &scope == &root_ && inProgram_ ? programSignatureFor(exp) : signatureFor(exp);
+        if (signature.params.size() != params.size()) {
+            signature.params.resize(params.size());
+            for (size_t i = 0; i < params.size(); i++) {
+                if (params[i].type == ExpType::LIST && params[i].list().size() >= 2) {
+                    annotate(signature.params[i], params[i].list()[1]);
+                }
+            }
+            if (hasReturnType) {
+                annotate(signature.result, items[4]);
+            }
+        }
+
+        // Bound before the body, for recursion.
+        bind(scope, items[1], {nullptr, &signature});
+
+        Scope fnScope;
+        fnScope.parent = &scope;
+        for (size_t i = 0; i < params.size(); i++) {
+            const auto& name = params[i].type == ExpType::LIST ? params[i].list()[0] : params[i];
+            fnScope.bindings[std::string(name.string())] = {&signature.params[i], nullptr};
+        }
+
+        auto bodyType = infer(items[bodyIndex], fnScope);
+        if (bodyType != EvaType::Void) {
+            widen(signature.result, bodyType);
+        }
+        return EvaType::Function;
+    }
+
+    // (square 2): arguments widen the parameters of the callee.
+    EvaType inferCall(const Exp& exp, Scope& scope) {
+        const auto& items = exp.list();
+        Binding* callee = nullptr;
+        if (items[0].type == ExpType::SYMBOL) {
+            callee = scope.lookup(items[0].string());
+        }
+        auto signature = callee != nullptr ? callee->signature : nullptr;
+
+        for (size_t i = 1; i < items.size(); i++) {
+            auto type = infer(items[i], scope);
+            if (signature != nullptr && i - 1 < signature->params.size()) {
+                widen(signature->params[i - 1], type);
+            }
+        }
+        return signature != nullptr ? signature->result.type : EvaType::Unknown;
+    }
+
+    // (extract v 0), (reduce + v): a lane of the vector. (insert v 0 x),
+    // (shuffle v w (0 4 1 5)): a vector.
+    EvaType inferVectorForm(const Exp& exp, Scope& scope) {
+        for (size_t i = 1; i < exp.list().size(); i++) {
+            infer(exp.list()[i], scope);
+        }
+        const auto& tag = exp.list()[0];
+        if (tag.isSymbol(extractSymbol_) && exp.list().size() > 1) {
+            return elementOf(exp.list()[1], scope);
+        }
+        if (tag.isSymbol(reduceSymbol_) && exp.list().size() > 2) {
+            return elementOf(exp.list()[2], scope);
+        }
+        return EvaType::Opaque;
+    }
+
+    // (get a i), (put a i x): an element of the array. A variable used as
+    // an index is i64, as the length, so that loops over an array count in
+    // one type.
+    EvaType inferElement(const Exp& exp, Scope& scope) {
+        for (size_t i = 1; i < exp.list().size(); i++) {
+            infer(exp.list()[i], scope);
+        }
+        if (exp.list().size() > 2 && exp.list()[2].type == ExpType::SYMBOL) {
+            auto binding = scope.lookup(exp.list()[2].string());
+            if (binding != nullptr && binding->slot != nullptr) {
+                widen(*binding->slot, EvaType::I64);
+            }
+        }
+        return exp.list().size() > 1 ? elementOf(exp.list()[1], scope) : EvaType::Opaque;
+    }
+
+    // (len a)
+    EvaType inferLen(const Exp& exp, Scope& scope) {
+        for (size_t i = 1; i < exp.list().size(); i++) {
+            infer(exp.list()[i], scope);
+        }
+        return EvaType::I64;
+    }
+
+    /**
+     * Type of the elements of an array or vector variable, from its
+     * annotation. Opaque if it has none, or for other expressions.
+     */
+    EvaType elementOf(const Exp& exp, Scope& scope) {
+        if (exp.type != ExpType::SYMBOL) {
+            return EvaType::Opaque;
+        }
+        auto binding = scope.lookup(exp.string());
+        if (binding == nullptr || binding->slot == nullptr ||
+            binding->slot->element == EvaType::Unknown) {
+            return EvaType::Opaque;
+        }
+        return binding->slot->element;
+    }
+
+    TypeSlot& slotOf(const Exp& form) { return types_[form.items]; }
+
+    Signature& signatureFor(const Exp& def) { return signatures_[def.items]; }
+
+    /**
+     * Slot of a top level var of a program, kept across its passes: the
+     * vars of a pass take the slots in order.
+     */
+    TypeSlot& programSlotOf(const Exp& var) {
+        if (programSlotsUsed_ == programSlots_.size()) {
+            programSlots_.emplace_back();
+        }
+        auto& slot = programSlots_[programSlotsUsed_++];
+        unitProgramForms_.emplace_back(var.items, &slot);
+        return slot;
+    }
+
+    /**
+     * Signature of a top level def of a program, as programSlotOf.
+     */
+    Signature& programSignatureFor(const Exp& def) {
+        if (programSignaturesUsed_ == programSignatures_.size()) {
+            programSignatures_.emplace_back();
+        }
+        auto& signature = programSignatures_[programSignaturesUsed_++];
+        unitProgramDefs_.emplace_back(def.items, &signature);
+        return signature;
+    }
+
+    /**
+     * Types of the top level bindings of the program, to detect changes.
+     */
+    std::vector<EvaType> programTypes() const {
+        std::vector<EvaType> types;
+        for (const auto& slot : programSlots_) {
+            types.push_back(slot.type);
+        }
+        for (const auto& signature : programSignatures_) {
+            for (const auto& param : signature.params) {
+                types.push_back(param.type);
+            }
+            types.push_back(signature.result.type);
+        }
+        return types;
+    }
+
+    void annotate(TypeSlot& slot, const Exp& typeName) {
+        // (vec 8 f32), (array 100 i64), (array i64)
+        if (typeName.type == ExpType::LIST) {
+            const auto& items = typeName.list();
+            auto element = items.size() > 1 && items[items.size() - 1].type == ExpType::SYMBOL
+                               ? typeFromName(items[items.size() - 1].string())
+                               : EvaType::Unknown;
+            slot = {EvaType::Opaque, /* annotated */ true, element};
+            return;
+        }
+        auto type = typeFromName(typeName.string());
+        if (type != EvaType::Unknown) {
+            slot = {type, /* annotated */ true};
+        }
+    }
+
+    /**
+     * Widens an inferred slot to also hold a value of the given type.
+     */
+    void widen(TypeSlot& slot, EvaType type) {
+        if (slot.annotated || type == EvaType::Unknown) {
+            return;
+        }
+        set(slot, slot.type == EvaType::Void ? EvaType::Void : unify(slot.type, type));
+    }
+
+    void set(TypeSlot& slot, EvaType type) {
+        if (slot.type != type) {
+            slot.type = type;
+            changed_ = true;
+        }
+    }
+
+    static void defaultToI32(TypeSlot& slot) {
+        if (slot.type == EvaType::Unknown) {
+            slot.type = EvaType::I32;
+        }
+    }
+
+    void bind(Scope& scope, const Exp& name, Binding binding) {
+        auto key = std::string(name.string());
+        scope.bindings[key] = binding;
+        if (&scope == &root_ && !inProgram_) {
+            unitRootNames_.push_back(key);
+        }
+    }
+
+    /**
+     * Top level bindings of the unit outlive its results: their types are
+     * copied to the root, and fixed, as their code is compiled.
+     */
+    void detachRootBindings() {
+        for (const auto& name : unitRootNames_) {
+            auto& binding = root_.bindings[name];
+            if (binding.slot != nullptr) {
+                rootSlots_.push_back({binding.slot->type, /* annotated */ true});
+                binding.slot = &rootSlots_.back();
+            }
+            if (binding.signature != nullptr) {
+                rootSignatures_.push_back(*binding.signature);
+                for (auto& param : rootSignatures_.back().params) {
+                    param.annotated = true;
+                }
+                rootSignatures_.back().result.annotated = true;
+                binding.signature = &rootSignatures_.back();
+            }
+        }
+        unitRootNames_.clear();
+    }
+
+    /**
+     * Inference rules of the special forms, indexed by keyword id; other
+     * lists are calls.
+     */
+    std::vector<Rule> rules_;
+
+    /**
+     * Results of the current unit, by the children span of the form.
+     */
+    std::unordered_map<const Exp*, TypeSlot> types_;
+    std::unordered_map<const Exp*, Signature> signatures_;
+
+    /**
+     * Top level scope, and the types of its bindings from earlier units.
+     */
+    Scope root_;
+    std::deque<TypeSlot> rootSlots_;
+    std::deque<Signature> rootSignatures_;
+
+    /**
+     * Names bound at the top level by the current unit.
+     */
+    std::vector<std::string> unitRootNames_;
+
+    /**
+     * Program inferred form by form: its top level bindings before it,
+     * the slots of its own ones, taken in order by each pass, and the
+     * slots of the forms of the current unit.
+     */
+    bool inProgram_ = false;
+    Bindings programRoot_;
+    std::deque<TypeSlot> programSlots_;
+    std::deque<Signature> programSignatures_;
+    size_t programSlotsUsed_ = 0;
+    size_t programSignaturesUsed_ = 0;
+    std::vector<std::pair<const Exp*, TypeSlot*>> unitProgramForms_;
+    std::vector<std::pair<const Exp*, Signature*>> unitProgramDefs_;
+
+    /**
+     * Top level types before the current pass of the program, and the
+     * passes made.
+     */
+    std::vector<EvaType> programSnapshot_;
+    int programPasses_ = 0;
+
+    /**
+     * Whether a type changed during the current pass.
+     */
+    bool changed_ = false;
+
+    uint32_t trueSymbol_;
+    uint32_t falseSymbol_;
+    uint32_t arrowSymbol_;
+    uint32_t extractSymbol_;
+    uint32_t reduceSymbol_;
+};
+
+#endif
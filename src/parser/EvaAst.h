@@ -0,0 +1,558 @@
+/**
+ * Compact AST for Eva programs.
+ *
+ * Nodes are 16-byte tagged values. String payloads are views into an
+ * interned pool, symbols are interned to dense integer ids, and list
+ * children are stored as contiguous spans; all of them live in a
+ * per-compilation arena (AstContext), so tearing down an AST is a single
+ * arena release.
+ */
+
+#ifndef EvaAst_h
+#define EvaAst_h
+
+#include <algorithm>
+#include <cassert>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * Expression type.
+ */
+enum class ExpType : unsigned char {
+    NUMBER,
+    DECIMAL,
+    STRING,
+    SYMBOL,
+    LIST,
+};
+
+class ExpList;
+
+/**
+ * Decodes the escapes of a string literal body in a single pass:
+ * \n, \t, \r, \", \\ and \xNN (one or two hex digits). Other escapes
+ * are kept as written.
+ */
+inline void decodeEscapes(std::string_view text, std::string& out) {
+    out.clear();
+    out.reserve(text.size());
+
+    auto hexDigit = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    };
+
+    for (size_t i = 0; i < text.size(); i++) {
+        auto c = text[i];
+        if (c != '\\' || i + 1 == text.size()) {
+            out += c;
+            continue;
+        }
+
+        switch (auto escape = text[++i]) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+
+            case 'x': {
+                auto digits = 0;
+                auto value = 0;
+                while (digits < 2 && i + 1 < text.size() &&
+                       hexDigit(text[i + 1]) >= 0) {
+                    value = value * 16 + hexDigit(text[++i]);
+                    digits++;
+                }
+                if (digits > 0) {
+                    out += (char)value;
+                } else {
+                    out += "\\x";
+                }
+                break;
+            }
+
+            default:
+                out += '\\';
+                out += escape;
+        }
+    }
+}
+
+/**
+ * Interned symbol.
+ */
+struct Symbol {
+    std::string_view name;
+
+    /**
+     * Dense id. Keywords have the same id in every AstContext, other
+     * symbols are numbered per context.
+     */
+    uint32_t id;
+};
+
+/**
+ * Process-wide registry of keyword symbols (special forms, constants).
+ * Each AstContext is seeded with the keywords in registration order, so
+ * a keyword id can be resolved once and used to dispatch on nodes from
+ * any context. Keywords are meant to be registered before parsing.
+ */
+class Keywords {
+public:
+    /**
+     * Returns the id of a keyword, registering it if needed.
+     */
+    static uint32_t intern(std::string_view name) {
+        std::lock_guard<std::mutex> lock(mutex_());
+        auto& names = names_();
+        for (uint32_t id = 0; id < names.size(); id++) {
+            if (names[id] == name) {
+                return id;
+            }
+        }
+        names.emplace_back(name);
+        return (uint32_t)names.size() - 1;
+    }
+
+    /**
+     * Registered keywords, indexed by id.
+     */
+    static std::vector<std::string> all() {
+        std::lock_guard<std::mutex> lock(mutex_());
+        return names_();
+    }
+
+private:
+    static std::vector<std::string>& names_() {
+        static std::vector<std::string> names;
+        return names;
+    }
+
+    static std::mutex& mutex_() {
+        static std::mutex mutex;
+        return mutex;
+    }
+};
+
+/**
+ * Expression: a tagged node. Copies are shallow, the payload is owned
+ * by the AstContext that created the node.
+ */
+struct Exp {
+    ExpType type;
+
+    /**
+     * Chars for strings and symbols, children for lists.
+     */
+    uint32_t size;
+
+    union {
+        int64_t number;
+        double decimal;
+        const char* chars;
+        const Symbol* symbol;
+        const Exp* items;
+    };
+
+    /**
+     * String or symbol text.
+     */
+    std::string_view string() const {
+        return type == ExpType::SYMBOL ? symbol->name
+                                       : std::string_view(chars, size);
+    }
+
+    /**
+     * Whether this is the symbol with the given id.
+     */
+    bool isSymbol(uint32_t id) const {
+        return type == ExpType::SYMBOL && symbol->id == id;
+    }
+
+    /**
+     * List children.
+     */
+    ExpList list() const;
+
+    // Numbers:
+    static Exp makeNumber(int64_t number) {
+        Exp exp;
+        exp.type = ExpType::NUMBER;
+        exp.size = 0;
+        exp.number = number;
+        return exp;
+    }
+
+    // Decimals:
+    static Exp makeDecimal(double decimal) {
+        Exp exp;
+        exp.type = ExpType::DECIMAL;
+        exp.size = 0;
+        exp.decimal = decimal;
+        return exp;
+    }
+
+    // Strings (text is interned by AstContext):
+    static Exp makeString(std::string_view text) {
+        Exp exp;
+        exp.type = ExpType::STRING;
+        exp.size = (uint32_t)text.size();
+        exp.chars = text.data();
+        return exp;
+    }
+
+    // Symbols (interned by AstContext):
+    static Exp makeSymbol(const Symbol* symbol) {
+        Exp exp;
+        exp.type = ExpType::SYMBOL;
+        exp.size = (uint32_t)symbol->name.size();
+        exp.symbol = symbol;
+        return exp;
+    }
+
+    // Lists (children are allocated by AstContext):
+    static Exp makeList(const Exp* items, size_t size) {
+        Exp exp;
+        exp.type = ExpType::LIST;
+        exp.size = (uint32_t)size;
+        exp.items = items;
+        return exp;
+    }
+};
+
+static_assert(sizeof(Exp) == 16, "Exp must stay a compact 16-byte node");
+
+/**
+ * Contiguous span of list children.
+ */
+class ExpList {
+public:
+    ExpList(const Exp* items, uint32_t size) : items_(items), size_(size) {}
+
+    const Exp* begin() const { return items_; }
+    const Exp* end() const { return items_ + size_; }
+
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    const Exp& operator[](size_t index) const {
+        assert(index < size_);
+        return items_[index];
+    }
+
+private:
+    const Exp* items_;
+    uint32_t size_;
+};
+
+inline ExpList Exp::list() const { return {items, size}; }
+
+/**
+ * Bump allocator over large blocks. Memory is only released when the
+ * arena is destroyed, or rewound to a mark.
+ */
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 64 * 1024) : blockSize_(blockSize) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * Allocates uninitialized memory.
+     */
+    void* allocate(size_t size, size_t alignment) {
+        auto offset = (alignment - (uintptr_t)cursor_ % alignment) % alignment;
+
+        if (cursor_ == nullptr || offset + size > (size_t)(end_ - cursor_)) {
+            // Large allocations get a block of their own, so the current
+            // block keeps serving small ones.
+            if (size + alignment > blockSize_ / 4) {
+                blocks_.emplace_back(new char[size + alignment]);
+                bytesReserved_ += size + alignment;
+                auto block = blocks_.back().get();
+                return block + (alignment - (uintptr_t)block % alignment) % alignment;
+            }
+            newBlock_();
+            offset = (alignment - (uintptr_t)cursor_ % alignment) % alignment;
+        }
+
+        auto result = cursor_ + offset;
+        cursor_ = result + size;
+        return result;
+    }
+
+    /**
+     * Allocates an uninitialized array of trivially destructible values.
+     */
+    template <typename T>
+    T* allocateArray(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value,
+                      "Arena values are never destroyed");
+        return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    /**
+     * Total size of the blocks owned by the arena.
+     */
+    size_t bytesReserved() const { return bytesReserved_; }
+
+    /**
+     * Allocation position, to rewind to.
+     */
+    struct Mark {
+        size_t blocks;
+        size_t bytesReserved;
+        char* cursor;
+        char* end;
+    };
+
+    Mark mark() const { return {blocks_.size(), bytesReserved_, cursor_, end_}; }
+
+    /**
+     * Releases everything allocated since the mark: the blocks created
+     * since are freed, the current block of the mark is reused.
+     */
+    void rewind(const Mark& mark) {
+        blocks_.resize(mark.blocks);
+        bytesReserved_ = mark.bytesReserved;
+        cursor_ = mark.cursor;
+        end_ = mark.end;
+    }
+
+private:
+    void newBlock_() {
+        blocks_.emplace_back(new char[blockSize_]);
+        bytesReserved_ += blockSize_;
+        cursor_ = blocks_.back().get();
+        end_ = cursor_ + blockSize_;
+    }
+
+    size_t blockSize_;
+    size_t bytesReserved_ = 0;
+
+    char* cursor_ = nullptr;
+    char* end_ = nullptr;
+
+    std::vector<std::unique_ptr<char[]>> blocks_;
+};
+
+/**
+ * Per-compilation AST storage: the node arena and the interned string
+ * pool. Nodes created by a context are valid as long as it is alive.
+ */
+class AstContext {
+public:
+    AstContext() {
+        for (const auto& keyword : Keywords::all()) {
+            internSymbol(keyword);
+        }
+        keywordsCount_ = (uint32_t)symbols_.size();
+
+        // Keyword names are found through their symbols.
+        strings_.clear();
+        keywordsMark_ = arena_.mark();
+    }
+
+    AstContext(const AstContext&) = delete;
+    AstContext& operator=(const AstContext&) = delete;
+
+    /**
+     * Installs a context as the current one for the calling thread,
+     * restoring the previous one on exit. The parser's semantic actions
+     * build nodes in the current context.
+     */
+    class Scope {
+    public:
+        explicit Scope(AstContext& context) : previous_(current_) {
+            current_ = &context;
+        }
+        ~Scope() { current_ = previous_; }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        AstContext* previous_;
+    };
+
+    /**
+     * Current context of the calling thread.
+     */
+    static AstContext& current() {
+        assert(current_ != nullptr && "No AstContext::Scope is active");
+        return *current_;
+    }
+
+    /**
+     * Number literal from its token: an integer (64-bit), or a decimal
+     * if it has a fractional part.
+     */
+    Exp number(std::string_view token) {
+        auto first = token.data();
+        auto last = token.data() + token.size();
+
+        if (token.find('.') != std::string_view::npos) {
+            double decimal;
+            auto result = std::from_chars(first, last, decimal);
+            if (result.ec != std::errc() || result.ptr != last) {
+                throwInvalidNumber(token, "is not a valid number");
+            }
+            return Exp::makeDecimal(decimal);
+        }
+
+        int64_t number;
+        auto result = std::from_chars(first, last, number);
+        if (result.ec != std::errc() || result.ptr != last) {
+            throwInvalidNumber(token, "does not fit in 64 bits");
+        }
+        return Exp::makeNumber(number);
+    }
+
+    /**
+     * Reports a number literal the parser cannot represent, like the
+     * parser's syntax errors.
+     */
+    [[noreturn]] static void throwInvalidNumber(std::string_view token,
+                                                const char* reason) {
+        auto message = "Number " + std::string(token) + " " + reason + "\n";
+        std::cerr << message;
+        throw std::runtime_error(message);
+    }
+
+    /**
+     * String literal from its token, including the quotes. The text is
+     * stored with its escapes decoded.
+     */
+    Exp string(std::string_view token) {
+        auto text = token.substr(1, token.size() - 2);
+        if (text.find('\\') == std::string_view::npos) {
+            return Exp::makeString(intern(text));
+        }
+        decodeEscapes(text, decoded_);
+        return Exp::makeString(intern(decoded_));
+    }
+
+    /**
+     * Symbol.
+     */
+    Exp symbol(std::string_view name) {
+        return Exp::makeSymbol(internSymbol(name));
+    }
+
+    /**
+     * List with the given children, copied into the arena.
+     */
+    Exp list(const Exp* items, size_t size) {
+        auto storage = arena_.allocateArray<Exp>(size);
+        std::copy(items, items + size, storage);
+        return Exp::makeList(storage, size);
+    }
+
+    /**
+     * Incremental list building, used by the parser: children of the
+     * lists being parsed are pushed on a shared scratch stack, and each
+     * list is copied into the arena as one span once it is closed.
+     * Nested lists always close before their parent resumes, so a single
+     * stack serves all of them.
+     */
+    Exp beginList() {
+        // A pending list only records where its children start.
+        return Exp::makeNumber((int64_t)scratch_.size());
+    }
+
+    void appendToList(const Exp& item) { scratch_.push_back(item); }
+
+    Exp endList(const Exp& pending) {
+        auto base = (size_t)pending.number;
+        auto result = list(scratch_.data() + base, scratch_.size() - base);
+        scratch_.resize(base);
+        return result;
+    }
+
+    /**
+     * Interns a string, returning a view into the pool.
+     */
+    std::string_view intern(std::string_view text) {
+        auto it = strings_.find(text);
+        if (it != strings_.end()) {
+            return *it;
+        }
+        auto chars = arena_.allocateArray<char>(text.size());
+        std::memcpy(chars, text.data(), text.size());
+        return *strings_.emplace(chars, text.size()).first;
+    }
+
+    /**
+     * Interns a symbol, assigning it the next dense id if it is new.
+     */
+    const Symbol* internSymbol(std::string_view name) {
+        auto it = symbols_.find(name);
+        if (it != symbols_.end()) {
+            return it->second;
+        }
+        auto symbol = arena_.allocateArray<Symbol>(1);
+        symbol->name = intern(name);
+        symbol->id = (uint32_t)symbols_.size();
+        symbols_.emplace(symbol->name, symbol);
+        return symbol;
+    }
+
+    /**
+     * Bytes reserved by the node and string arena.
+     */
+    size_t bytesReserved() const { return arena_.bytesReserved(); }
+
+    /**
+     * Releases the nodes, strings and symbols created so far, except the
+     * keywords, so that the context serves the next parse without being
+     * built again (one form after another of a stream). Nodes of the
+     * context are invalid afterwards.
+     */
+    void reset() {
+        for (auto it = symbols_.begin(); it != symbols_.end();) {
+            it = it->second->id >= keywordsCount_ ? symbols_.erase(it) : std::next(it);
+        }
+        strings_.clear();
+        scratch_.clear();
+        arena_.rewind(keywordsMark_);
+    }
+
+private:
+    Arena arena_;
+
+    /**
+     * Number of keyword symbols (ids below it), and the arena position
+     * after them.
+     */
+    uint32_t keywordsCount_ = 0;
+    Arena::Mark keywordsMark_{};
+
+    std::unordered_set<std::string_view> strings_;
+
+    std::unordered_map<std::string_view, const Symbol*> symbols_;
+
+    std::vector<Exp> scratch_;
+
+    std::string decoded_;
+
+    static inline thread_local AstContext* current_ = nullptr;
+};
+
+#endif
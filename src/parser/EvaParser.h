@@ -10,9 +10,15 @@
  * To regenerate run:
  *
  *   syntax-cli \
- *     --grammar ~/path-to-grammar-file \
- *     --mode <parsing-mode> \
- *     --output ~/ParserClassName.h
+ *     --grammar src/parser/EvaGrammar.bnf \
+ *     --mode LALR1 \
+ *     --custom-tokenizer src/parser/EvaTokenizer.h \
+ *     --output src/parser/EvaParser.h
+ *   node src/parser/postprocess.js src/parser/EvaParser.h
+ *
+ * The second step rewrites the generated code for the dense parsing
+ * table and the tokenizer's tokens, see postprocess.js. Do not edit this
+ * file by hand.
  */
 #ifndef __Syntax_LR_Parser_h
 #define __Syntax_LR_Parser_h
@@ -25,7 +31,6 @@
 #include <iostream>
 #include <map>
 #include <memory>
-#include <regex>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -51,47 +56,17 @@
 //
 // clang-format off
 #include <string>
-#include <vector>
-
-/**
-*   Expression type.
-*/
+#include <string_view>
 
-enum class ExpType {
-    NUMBER,
-    STRING,
-    SYMBOL,
-    LIST,
-};
+#include "./EvaAst.h"
+#include "./StructuralIndex.h"
 
 /**
-*   Expression.
+*   AST context the semantic actions build nodes in.
 */
 
-struct Exp {
-    ExpType type;
-
-    int number;
-    std::string string;
-    std::vector<Exp> list;
-
-    // Numbers:
-    Exp(int number) : type(ExpType::NUMBER), number(number) {}
-
-    // Strings, Symbols:
-    Exp(std::string& strVal) {
-        if (strVal[0] == '"') {
-            type = ExpType::STRING;
-            string = strVal.substr(1, strVal.size() - 2);
-        } else {
-            type = ExpType::SYMBOL;
-            string = strVal;
-        }
-    }
+inline AstContext& ast() { return AstContext::current(); }
 
-    // Lists:
-    Exp(std::vector<Exp> list) : type(ExpType::LIST), list(list) {}
-};
 using Value = Exp;  // clang-format on
 
 namespace syntax {
@@ -101,9 +76,28 @@ namespace syntax {
  */
 // clang-format off
 /**
- * Generic tokenizer used by the parser in the Syntax tool.
+ * Hand-written DFA tokenizer for the Eva grammar.
  *
- * https://www.npmjs.com/package/syntax-cli
+ * Replaces the generic regex-based tokenizer of the Syntax tool. It is
+ * plugged in at generation time, so it survives parser regeneration
+ * (see EvaParser.h for the full steps):
+ *
+ *   syntax-cli \
+ *     --grammar src/parser/EvaGrammar.bnf \
+ *     --mode LALR1 \
+ *     --custom-tokenizer src/parser/EvaTokenizer.h \
+ *     --output src/parser/EvaParser.h
+ *
+ * Recognizes the same token set as the `%lex` section of EvaGrammar.bnf
+ * (parens, comments, whitespace, STRING, NUMBER, SYMBOL) in a single
+ * linear pass over the source buffer, without a regex engine. Runs of
+ * whitespace, digits and symbol chars, and string and line comment
+ * bodies, are skipped a 64-byte block at a time using the SIMD class
+ * bitmasks from StructuralIndex.h.
+ *
+ * Note: this file is inserted into the generated parser inside the
+ * `syntax` namespace, so it must not include any headers; the headers it
+ * needs come from the parser template and grammar prologue.
  */
 
 #ifndef __Syntax_Tokenizer_h
@@ -113,6 +107,9 @@ class Tokenizer;
 
 // ------------------------------------------------------------------
 // TokenType.
+//
+// The numbers are the grammar symbol encoding used by the parsing
+// table, and must match the ones syntax-cli assigns for EvaGrammar.bnf.
 
 enum class TokenType {
   __EMPTY = -1,
@@ -128,33 +125,108 @@ enum class TokenType {
 
 // ------------------------------------------------------------------
 // Token.
+//
+// Plain value record: `value` is a view into the tokenizer's source
+// buffer, which must outlive the token. Line and column are not tracked
+// per token; they are computed from the offsets by `Tokenizer::locate`
+// only when a diagnostic needs them.
 
 struct Token {
   TokenType type;
-  std::string value;
+  std::string_view value;
 
   int startOffset;
   int endOffset;
-  int startLine;
-  int endLine;
-  int startColumn;
-  int endColumn;
 };
 
-using SharedToken = std::shared_ptr<Token>;
+// ------------------------------------------------------------------
+// Line-based location of an offset.
 
-typedef TokenType (*LexRuleHandler)(const Tokenizer&, const std::string&);
+struct Location {
+  int line;
+  int column;
+};
 
 // ------------------------------------------------------------------
-// Lex rule: [regex, handler]
+// Character classes (DFA input alphabet).
+
+enum class CharClass : unsigned char {
+  Other,
+  Space,   // \s
+  Digit,   // \d
+  Symbol,  // [\w\-+*=!<>] minus digits
+  Slash,   // `/`: comment start, or a symbol char
+  Quote,   // `"`
+  LParen,  // `(`
+  RParen,  // `)`
+};
 
-struct LexRule {
-  std::regex regex;
-  LexRuleHandler handler;
+struct CharClassTable {
+  CharClass classes[256];
 };
 
+constexpr CharClassTable makeCharClassTable() {
+  CharClassTable table{};
+
+  for (int c = 0; c < 256; c++) {
+    table.classes[c] = CharClass::Other;
+  }
+
+  for (int c = 'a'; c <= 'z'; c++) {
+    table.classes[c] = CharClass::Symbol;
+  }
+  for (int c = 'A'; c <= 'Z'; c++) {
+    table.classes[c] = CharClass::Symbol;
+  }
+  for (int c = '0'; c <= '9'; c++) {
+    table.classes[c] = CharClass::Digit;
+  }
+
+  table.classes[(unsigned char)'_'] = CharClass::Symbol;
+  table.classes[(unsigned char)'-'] = CharClass::Symbol;
+  table.classes[(unsigned char)'+'] = CharClass::Symbol;
+  table.classes[(unsigned char)'*'] = CharClass::Symbol;
+  table.classes[(unsigned char)'='] = CharClass::Symbol;
+  table.classes[(unsigned char)'!'] = CharClass::Symbol;
+  table.classes[(unsigned char)'<'] = CharClass::Symbol;
+  table.classes[(unsigned char)'>'] = CharClass::Symbol;
+
+  table.classes[(unsigned char)' '] = CharClass::Space;
+  table.classes[(unsigned char)'\t'] = CharClass::Space;
+  table.classes[(unsigned char)'\n'] = CharClass::Space;
+  table.classes[(unsigned char)'\v'] = CharClass::Space;
+  table.classes[(unsigned char)'\f'] = CharClass::Space;
+  table.classes[(unsigned char)'\r'] = CharClass::Space;
+
+  table.classes[(unsigned char)'/'] = CharClass::Slash;
+  table.classes[(unsigned char)'"'] = CharClass::Quote;
+  table.classes[(unsigned char)'('] = CharClass::LParen;
+  table.classes[(unsigned char)')'] = CharClass::RParen;
+
+  return table;
+}
+
+constexpr CharClassTable kCharClasses = makeCharClassTable();
+
+inline CharClass charClass(char c) {
+  return kCharClasses.classes[(unsigned char)c];
+}
+
+/**
+ * Whether a char continues a SYMBOL: [\w\-+*=!<>/].
+ */
+inline bool isSymbolChar(char c) {
+  auto cc = charClass(c);
+  return cc == CharClass::Symbol || cc == CharClass::Digit ||
+         cc == CharClass::Slash;
+}
+
+inline bool isSpaceChar(char c) { return charClass(c) == CharClass::Space; }
+
+inline bool isDigitChar(char c) { return charClass(c) == CharClass::Digit; }
+
 // ------------------------------------------------------------------
-// Token.
+// Tokenizer state.
 
 enum TokenizerState {
   // clang-format off
@@ -168,32 +240,29 @@ enum TokenizerState {
 class Tokenizer {
  public:
   /**
-   * Initializes a parsing string.
+   * Initializes a parsing string. The string is not copied, and must
+   * outlive the tokenizer and the tokens it returns.
+   *
+   * `origin` is the location of the string in its source, when it is cut
+   * out of a larger one (a top-level form), so that diagnostics give
+   * locations in the source.
    */
-  void initString(const std::string& str) {
+  void initString(std::string_view str, Location origin = {1, 0}) {
     str_ = str;
+    origin_ = origin;
 
     // Initialize states.
     states_.clear();
     states_.push_back(TokenizerState::INITIAL);
 
     cursor_ = 0;
-    currentLine_ = 1;
-    currentColumn_ = 0;
-    currentLineBeginOffset_ = 0;
-
-    tokenStartOffset_ = 0;
-    tokenEndOffset_ = 0;
-    tokenStartLine_ = 0;
-    tokenEndLine_ = 0;
-    tokenStartColumn_ = 0;
-    tokenEndColumn_ = 0;
+    std::fill(std::begin(blockStarts_), std::end(blockStarts_), -1);
   }
 
   /**
    * Whether there are still tokens in the stream.
    */
-  inline bool hasMoreTokens() { return cursor_ <= str_.length(); }
+  inline bool hasMoreTokens() { return cursor_ <= (int)str_.length(); }
 
   /**
    * Returns current tokenizing state.
@@ -220,70 +289,68 @@ class Tokenizer {
   }
 
   /**
-   * Returns next token.
+   * Returns next token. Whitespace and comments are skipped in a loop.
    */
-  SharedToken getNextToken() {
-    if (!hasMoreTokens()) {
-      yytext = __EOF;
-      return toToken(TokenType::__EOF);
-    }
-
-    auto strSlice = str_.substr(cursor_);
-
-    auto lexRulesForState = lexRulesByStartConditions_.at(getCurrentState());
-
-    for (const auto& ruleIndex : lexRulesForState) {
-      auto rule = lexRules_[ruleIndex];
-      std::smatch sm;
+  Token getNextToken() {
+    for (;;) {
+      if (!hasMoreTokens()) {
+        yytext = __EOF;
+        return Token{TokenType::__EOF, yytext, cursor_, cursor_};
+      }
 
-      if (std::regex_search(strSlice, sm, rule.regex)) {
-        yytext = sm[0];
+      if (isEOF()) {
+        auto offset = cursor_++;
+        yytext = __EOF;
+        return Token{TokenType::__EOF, yytext, offset, offset};
+      }
 
-        captureLocations_(yytext);
-        cursor_ += yytext.length();
+      auto start = cursor_;
+      auto tokenType = scan_();
 
-        // Manual handling of EOF token (the end of string). Return it
-        // as `EOF` symbol.
-        if (yytext.length() == 0) {
-          cursor_++;
-        }
+      if (tokenType != TokenType::__EMPTY) {
+        yytext = str_.substr(start, cursor_ - start);
+        return Token{tokenType, yytext, start, cursor_};
+      }
+    }
+  }
 
-        auto tokenType = rule.handler(*this, yytext);
+  /**
+   * Whether the cursor is at the EOF.
+   */
+  inline bool isEOF() { return cursor_ == (int)str_.length(); }
 
-        if (tokenType == TokenType::__EMPTY) {
-          return getNextToken();
-        }
+  /**
+   * Computes the line-based location of an offset, in the source of the
+   * string. This rescans the string up to the offset, and is meant for
+   * diagnostics only.
+   */
+  Location locate(int offset) const {
+    return advance(origin_, str_.substr(0, std::max(offset, 0)));
+  }
 
-        return toToken(tokenType);
+  /**
+   * Location after `text`, which starts at `location`.
+   */
+  static Location advance(Location location, std::string_view text) {
+    for (auto c : text) {
+      if (c == '\n') {
+        location.line++;
+        location.column = 0;
+      } else {
+        location.column++;
       }
     }
-
-    if (isEOF()) {
-      cursor_++;
-      yytext = __EOF;
-      return toToken(TokenType::__EOF);
-    }
-
-    throwUnexpectedToken(std::string(1, strSlice[0]), currentLine_,
-                         currentColumn_);
+    return location;
   }
 
   /**
-   * Whether the cursor is at the EOF.
+   * Throws default "Unexpected token" exception for the token at
+   * the offset.
    */
-  inline bool isEOF() { return cursor_ == str_.length(); }
-
-  SharedToken toToken(TokenType tokenType) {
-    return std::shared_ptr<Token>(new Token{
-        .type = tokenType,
-        .value = yytext,
-        .startOffset = tokenStartOffset_,
-        .endOffset = tokenEndOffset_,
-        .startLine = tokenStartLine_,
-        .endLine = tokenEndLine_,
-        .startColumn = tokenStartColumn_,
-        .endColumn = tokenEndColumn_,
-    });
+  [[noreturn]] void throwUnexpectedToken(std::string_view symbol,
+                                         int offset) {
+    auto location = locate(offset);
+    throwUnexpectedToken(symbol, location.line, location.column);
   }
 
   /**
@@ -291,17 +358,20 @@ class Tokenizer {
    * line from the source, pointing with the ^ marker to the bad token.
    * In addition, shows `line:column` location.
    */
-  [[noreturn]] void throwUnexpectedToken(const std::string& symbol, int line,
+  [[noreturn]] void throwUnexpectedToken(std::string_view symbol, int line,
                                          int column) {
-    std::stringstream ss{str_};
+    std::stringstream ss{std::string(str_)};
     std::string lineStr;
-    int currentLine = 1;
+    int currentLine = origin_.line;
 
     while (currentLine++ <= line) {
       std::getline(ss, lineStr, '\n');
     }
 
-    auto pad = std::string(column, ' ');
+    // The first line of the string starts at the origin's column.
+    auto pad = std::string(
+        std::max(line == origin_.line ? column - origin_.column : column, 0),
+        ' ');
 
     std::stringstream errMsg;
 
@@ -315,163 +385,234 @@ class Tokenizer {
   }
 
   /**
-   * Matched text.
+   * Matched text (a view into the source buffer).
    */
-  std::string yytext;
+  std::string_view yytext;
 
  private:
   /**
-   * Captures token locations.
+   * Runs the DFA from the cursor, advancing it past the longest match.
+   * Returns the matched token type, or `__EMPTY` for skipped input
+   * (whitespace and comments).
+   *
+   * Mirrors the first-match order of the lex rules in the grammar:
+   * `(`, `)`, line comment, block comment, whitespace, STRING, NUMBER,
+   * SYMBOL.
    */
-  void captureLocations_(const std::string& matched) {
-    auto len = matched.length();
-
-    // Absolute offsets.
-    tokenStartOffset_ = cursor_;
+  TokenType scan_() {
+    const auto length = (int)str_.length();
+    auto c = str_[cursor_];
+
+    switch (charClass(c)) {
+      // (
+      case CharClass::LParen:
+        cursor_++;
+        return TokenType::TOKEN_TYPE_7;
+
+      // )
+      case CharClass::RParen:
+        cursor_++;
+        return TokenType::TOKEN_TYPE_8;
+
+      // \s+
+      case CharClass::Space:
+        cursor_ = skipRun_<StructuralClass::Space, isSpaceChar>(cursor_ + 1);
+        return TokenType::__EMPTY;
+
+      // \"(\\.|[^\"\\])*\"
+      case CharClass::Quote: {
+        auto end = cursor_;
+        do {
+          end = findNext_<StructuralClass::Quote>(end + 1);
+        } while (end < length && isEscaped_(end));
+        if (end == length) {
+          throwUnexpectedToken("\"", cursor_);
+        }
+        cursor_ = end + 1;
+        return TokenType::STRING;
+      }
 
-    // Line-based locations, start.
-    tokenStartLine_ = currentLine_;
-    tokenStartColumn_ = tokenStartOffset_ - currentLineBeginOffset_;
+      // \d+(\.\d+)?
+      case CharClass::Digit:
+        cursor_ = skipRun_<StructuralClass::Digit, isDigitChar>(cursor_ + 1);
+        if (cursor_ + 1 < length && str_[cursor_] == '.' &&
+            isDigitChar(str_[cursor_ + 1])) {
+          cursor_ = skipRun_<StructuralClass::Digit, isDigitChar>(cursor_ + 2);
+        }
+        return TokenType::NUMBER;
 
-    // Extract `\n` in the matched token.
-    std::stringstream ss{matched};
-    std::string lineStr;
-    std::getline(ss, lineStr, '\n');
-    while (ss.tellg() > 0 && ss.tellg() <= len) {
-      currentLine_++;
-      currentLineBeginOffset_ = tokenStartOffset_ + ss.tellg();
-      std::getline(ss, lineStr, '\n');
-    }
+      // \/\/.* and \/\*[\s\S]*?\*\/, otherwise a symbol.
+      case CharClass::Slash:
+        if (cursor_ + 1 < length && str_[cursor_ + 1] == '/') {
+          cursor_ = findNext_<StructuralClass::LineEnd>(cursor_ + 2);
+          return TokenType::__EMPTY;
+        }
+        if (cursor_ + 1 < length && str_[cursor_ + 1] == '*') {
+          auto end = str_.find("*/", cursor_ + 2);
+          if (end != std::string_view::npos) {
+            cursor_ = end + 2;
+            return TokenType::__EMPTY;
+          }
+        }
+        return scanSymbol_();
 
-    tokenEndOffset_ = cursor_ + len;
+      // [\w\-+*=!<>/]+
+      case CharClass::Symbol:
+        return scanSymbol_();
 
-    // Line-based locations, end.
-    tokenEndLine_ = currentLine_;
-    tokenEndColumn_ = tokenEndOffset_ - currentLineBeginOffset_;
-    currentColumn_ = tokenEndColumn_;
+      default:
+        throwUnexpectedToken(str_.substr(cursor_, 1), cursor_);
+    }
   }
 
   /**
-   * Lexical rules.
+   * Consumes a run of symbol chars.
    */
-  // clang-format off
-  static constexpr size_t LEX_RULES_COUNT = 8;
-  static std::array<LexRule, LEX_RULES_COUNT> lexRules_;
-  static std::map<TokenizerState, std::vector<size_t>> lexRulesByStartConditions_;
-  // clang-format on
+  TokenType scanSymbol_() {
+    cursor_ = skipRun_<StructuralClass::Symbol, isSymbolChar>(cursor_ + 1);
+    return TokenType::SYMBOL;
+  }
 
   /**
-   * Special EOF token.
+   * Whether the char at `offset` in a string is escaped: preceded by an
+   * odd number of backslashes.
    */
-  static std::string __EOF;
+  bool isEscaped_(int offset) const {
+    auto backslashes = 0;
+    while (str_[offset - backslashes - 1] == '\\') {
+      backslashes++;
+    }
+    return backslashes % 2 == 1;
+  }
 
   /**
-   * Tokenizing string.
+   * Returns the end of the run of chars in a class starting at `from`:
+   * the first offset not in the class, or the string length.
    */
-  std::string str_;
+  template <StructuralClass cls, bool (*inClass)(char)>
+  int skipRun_(int from) {
+    const auto length = (int)str_.length();
+
+    // Most runs end right away (single-char separators, short numbers):
+    // check the next char directly before going to the block masks.
+    if (from >= length || !inClass(str_[from])) {
+      return from;
+    }
 
-  /**
-   * Cursor for current symbol.
-   */
-  int cursor_;
+    while (from < length) {
+      auto start = blockStart_(from);
+      auto outside = ~blockMask_<cls>(start) >> (from - start);
 
-  /**
-   * States.
-   */
-  std::vector<TokenizerState> states_;
+      // Bits shifted in at the top are zero, i.e. "in the class": when no
+      // bit is left, the run continues into the next block.
+      if (outside != 0) {
+        return std::min(from + (int)lowestBit(outside), length);
+      }
+      from = start + (int)STRUCTURAL_BLOCK_SIZE;
+    }
 
-  /**
-   * Line-based location tracking.
-   */
-  int currentLine_;
-  int currentColumn_;
-  int currentLineBeginOffset_;
+    return length;
+  }
 
   /**
-   * Location data of a matched token.
+   * Returns the first offset from `from` with a char in a class, or the
+   * string length if there is none.
    */
-  int tokenStartOffset_;
-  int tokenEndOffset_;
-  int tokenStartLine_;
-  int tokenEndLine_;
-  int tokenStartColumn_;
-  int tokenEndColumn_;
-};
+  template <StructuralClass cls>
+  int findNext_(int from) {
+    const auto length = (int)str_.length();
 
-// ------------------------------------------------------------------
-// Lexical rule handlers.
+    while (from < length) {
+      auto start = blockStart_(from);
+      auto inside = blockMask_<cls>(start) >> (from - start);
 
-std::string Tokenizer::__EOF("$");
+      if (inside != 0) {
+        return from + (int)lowestBit(inside);
+      }
+      from = start + (int)STRUCTURAL_BLOCK_SIZE;
+    }
 
-// clang-format off
-inline TokenType _lexRule1(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::TOKEN_TYPE_7;
-}
+    return length;
+  }
 
-inline TokenType _lexRule2(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::TOKEN_TYPE_8;
-}
+  /**
+   * Start of the 64-byte block containing `offset`.
+   */
+  static int blockStart_(int offset) {
+    return offset & ~(int)(STRUCTURAL_BLOCK_SIZE - 1);
+  }
 
-inline TokenType _lexRule3(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::__EMPTY;
-}
+  /**
+   * Class mask of the block at `start`. A block is classified once per
+   * class, when the cursor first needs that class in it.
+   */
+  template <StructuralClass cls>
+  uint64_t blockMask_(int start) {
+    auto index = (size_t)cls;
+
+    if (start != blockStarts_[index]) {
+      blockStarts_[index] = start;
+      auto available = str_.length() - start;
+      blockMasks_[index] =
+          available >= STRUCTURAL_BLOCK_SIZE
+              ? classifyBlock<cls>(str_.data() + start)
+              : classifyPartialBlock<cls>(str_.data() + start, available);
+    }
 
-inline TokenType _lexRule4(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::__EMPTY;
-}
+    return blockMasks_[index];
+  }
 
-inline TokenType _lexRule5(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::__EMPTY;
-}
+  /**
+   * Special EOF token.
+   */
+  static constexpr std::string_view __EOF = "$";
 
-inline TokenType _lexRule6(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::STRING;
-}
+  /**
+   * Tokenizing string (not owned).
+   */
+  std::string_view str_;
 
-inline TokenType _lexRule7(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::NUMBER;
-}
+  /**
+   * Location of the string in its source.
+   */
+  Location origin_{1, 0};
 
-inline TokenType _lexRule8(const Tokenizer& tokenizer, const std::string& yytext) {
-return TokenType::SYMBOL;
-}
-// clang-format on
+  /**
+   * Cursor for current symbol.
+   */
+  int cursor_;
 
-// ------------------------------------------------------------------
-// Lexical rules.
+  /**
+   * States.
+   */
+  std::vector<TokenizerState> states_;
 
-// clang-format off
-std::array<LexRule, Tokenizer::LEX_RULES_COUNT> Tokenizer::lexRules_ = {{
-  {std::regex(R"(^\()"), &_lexRule1},
-  {std::regex(R"(^\))"), &_lexRule2},
-  {std::regex(R"(^VV.*)"), &_lexRule3},
-  {std::regex(R"(^V\*[\s\S]*?\*\/)"), &_lexRule4},
-  {std::regex(R"(^\s+)"), &_lexRule5},
-  {std::regex(R"(^"[^\"]*")"), &_lexRule6},
-  {std::regex(R"(^\d+)"), &_lexRule7},
-  {std::regex(R"(^[\w\-+*=!<>/]+)"), &_lexRule8}
-}};
-std::map<TokenizerState, std::vector<size_t>> Tokenizer::lexRulesByStartConditions_ =  {{TokenizerState::INITIAL, {0, 1, 2, 3, 4, 5, 6, 7}}};
-// clang-format on
+  /**
+   * Per class: mask of the last classified block, and its offset.
+   */
+  uint64_t blockMasks_[STRUCTURAL_CLASSES_COUNT];
+  int blockStarts_[STRUCTURAL_CLASSES_COUNT];
+};
 
 #endif
 // clang-format on
 
-#define POP_V()              \
-  parser.valuesStack.back(); \
+#define POP_V()                         \
+  std::move(parser.valuesStack.back()); \
   parser.valuesStack.pop_back()
 
 #define POP_T()              \
   parser.tokensStack.back(); \
   parser.tokensStack.pop_back()
 
-#define PUSH_VR() parser.valuesStack.push_back(__)
+#define PUSH_VR() parser.valuesStack.push_back(std::move(__))
 #define PUSH_TR() parser.tokensStack.push_back(__)
 
 /**
  * Parsing table type.
  */
-enum class TE {
+enum class TE : unsigned char {
+  Error,
   Accept,
   Shift,
   Reduce,
@@ -479,11 +620,12 @@ enum class TE {
 };
 
 /**
- * Parsing table entry.
+ * Parsing table entry. Cells with no action hold the `TE::Error`
+ * sentinel.
  */
 struct TableEntry {
   TE type;
-  int value;
+  unsigned short value;
 };
 
 // clang-format off
@@ -506,10 +648,6 @@ struct Production {
   ProductionHandler handler;
 };
 
-// Key: Encoded symbol (terminal or non-terminal) index
-// Value: TableEntry
-using Row = std::map<int, TableEntry>;
-
 /**
  * Parser class.
  */
@@ -523,9 +661,9 @@ class EvaParser {
   std::vector<Value> valuesStack;
 
   /**
-   * Token values stack.
+   * Token values stack (views into the parsing string).
    */
-  std::vector<std::string> tokensStack;
+  std::vector<std::string_view> tokensStack;
 
   /**
    * Parsing states stack.
@@ -542,16 +680,39 @@ class EvaParser {
    */
   int previousState;
 
+  // clang-format off
+  static constexpr size_t PRODUCTIONS_COUNT = 9;
+  static constexpr size_t ROWS_COUNT = 11;
+  static constexpr size_t COLUMNS_COUNT = 10;
+  // clang-format on
+
   /**
-   * Parses a string.
+   * Action for a state and an encoded symbol: a single load from
+   * the dense table.
    */
-  Value parse(const std::string& str) {
+  static const TableEntry& action(int state, int symbol) {
+    return table_[state][symbol];
+  }
+
+  /**
+   * Encoded production by its number.
+   */
+  static const Production& production(int number) {
+    return productions_[number];
+  }
+
+  /**
+   * Parses a string. The string is not copied, and must stay alive
+   * for the duration of the call. `origin` is its location in the
+   * source, for syntax errors.
+   */
+  Value parse(std::string_view str, Location origin = {1, 0}) {
     // clang-format off
     
     // clang-format on
 
     // Initialize the tokenizer and the string.
-    tokenizer.initString(str);
+    tokenizer.initString(str, origin);
 
     // Initialize the stacks.
     valuesStack.clear();
@@ -567,18 +728,18 @@ class EvaParser {
     // Main parsing loop.
     for (;;) {
       auto state = statesStack.back();
-      auto column = (int)token->type;
+      auto column = (int)token.type;
 
-      if (table_[state].count(column) == 0) {
+      auto entry = table_[state][column];
+
+      if (entry.type == TE::Error) {
         throwUnexpectedToken(token);
       }
 
-      auto entry = table_[state].at(column);
-
       // Shift a token, go to state.
       if (entry.type == TE::Shift) {
         // Push token.
-        tokensStack.push_back(token->value);
+        tokensStack.push_back(token.value);
 
         // Push next state number: "s5" -> 5
         statesStack.push_back(entry.value);
@@ -592,7 +753,7 @@ class EvaParser {
         auto productionNumber = entry.value;
         auto production = productions_[productionNumber];
 
-        tokenizer.yytext = shiftedToken->value;
+        tokenizer.yytext = shiftedToken.value;
 
         auto rhsLength = production.rhsLength;
         while (rhsLength > 0) {
@@ -606,7 +767,7 @@ class EvaParser {
         auto previousState = statesStack.back();
 
         auto symbolToReduceWith = production.opcode;
-        auto nextStateEntry = table_[previousState].at(symbolToReduceWith);
+        auto nextStateEntry = table_[previousState][symbolToReduceWith];
         assert(nextStateEntry.type == TE::Transit);
 
         statesStack.push_back(nextStateEntry.value);
@@ -619,7 +780,7 @@ class EvaParser {
 
         // Pop the parsed value.
         // clang-format off
-        auto result = valuesStack.back(); valuesStack.pop_back();
+        auto result = std::move(valuesStack.back()); valuesStack.pop_back();
         // clang-format on
 
         if (statesStack.size() != 1 || statesStack.back() != 0 ||
@@ -642,22 +803,33 @@ class EvaParser {
   /**
    * Throws parser error on unexpected token.
    */
-  [[noreturn]] void throwUnexpectedToken(SharedToken token) {
-    if (token->type == TokenType::__EOF && !tokenizer.hasMoreTokens()) {
+  [[noreturn]] void throwUnexpectedToken(const Token& token) {
+    if (token.type == TokenType::__EOF && !tokenizer.hasMoreTokens()) {
       std::string errMsg = "Unexpected end of input.\n";
       std::cerr << errMsg;
       throw std::runtime_error(errMsg.c_str());
     }
-    tokenizer.throwUnexpectedToken(token->value, token->startLine,
-                                   token->startColumn);
+    tokenizer.throwUnexpectedToken(token.value, token.startOffset);
   }
 
-  // clang-format off
-  static constexpr size_t PRODUCTIONS_COUNT = 9;
   static std::array<Production, PRODUCTIONS_COUNT> productions_;
 
-  static constexpr size_t ROWS_COUNT = 11;
-  static std::array<Row, ROWS_COUNT> table_;
+  // Dense action/goto table: rows are states, columns are encoded
+  // symbols (terminals and non-terminals).
+  // clang-format off
+  static constexpr TableEntry table_[ROWS_COUNT][COLUMNS_COUNT] = {
+      {{TE::Transit, 1}, {TE::Transit, 2}, {TE::Transit, 3}, {TE::Error, 0}, {TE::Shift, 4}, {TE::Shift, 5}, {TE::Shift, 6}, {TE::Shift, 7}, {TE::Error, 0}, {TE::Error, 0}},
+      {{TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Accept, 0}},
+      {{TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Reduce, 1}, {TE::Reduce, 1}, {TE::Reduce, 1}, {TE::Reduce, 1}, {TE::Reduce, 1}, {TE::Reduce, 1}},
+      {{TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Reduce, 2}, {TE::Reduce, 2}, {TE::Reduce, 2}, {TE::Reduce, 2}, {TE::Reduce, 2}, {TE::Reduce, 2}},
+      {{TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Reduce, 3}, {TE::Reduce, 3}, {TE::Reduce, 3}, {TE::Reduce, 3}, {TE::Reduce, 3}, {TE::Reduce, 3}},
+      {{TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Reduce, 4}, {TE::Reduce, 4}, {TE::Reduce, 4}, {TE::Reduce, 4}, {TE::Reduce, 4}, {TE::Reduce, 4}},
+      {{TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Reduce, 5}, {TE::Reduce, 5}, {TE::Reduce, 5}, {TE::Reduce, 5}, {TE::Reduce, 5}, {TE::Reduce, 5}},
+      {{TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Transit, 8}, {TE::Reduce, 7}, {TE::Reduce, 7}, {TE::Reduce, 7}, {TE::Reduce, 7}, {TE::Reduce, 7}, {TE::Error, 0}},
+      {{TE::Transit, 10}, {TE::Transit, 2}, {TE::Transit, 3}, {TE::Error, 0}, {TE::Shift, 4}, {TE::Shift, 5}, {TE::Shift, 6}, {TE::Shift, 7}, {TE::Shift, 9}, {TE::Error, 0}},
+      {{TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Reduce, 6}, {TE::Reduce, 6}, {TE::Reduce, 6}, {TE::Reduce, 6}, {TE::Reduce, 6}, {TE::Reduce, 6}},
+      {{TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Error, 0}, {TE::Reduce, 8}, {TE::Reduce, 8}, {TE::Reduce, 8}, {TE::Reduce, 8}, {TE::Reduce, 8}, {TE::Error, 0}}
+  };
   // clang-format on
 };
 
@@ -669,7 +841,7 @@ void _handler1(yyparse& parser) {
 // Semantic action prologue.
 auto _1 = POP_V();
 
-auto __ = _1;
+auto __ = std::move(_1);
 
  // Semantic action epilogue.
 PUSH_VR();
@@ -680,7 +852,7 @@ void _handler2(yyparse& parser) {
 // Semantic action prologue.
 auto _1 = POP_V();
 
-auto __ = _1;
+auto __ = std::move(_1);
 
  // Semantic action epilogue.
 PUSH_VR();
@@ -691,7 +863,7 @@ void _handler3(yyparse& parser) {
 // Semantic action prologue.
 auto _1 = POP_V();
 
-auto __ = _1;
+auto __ = std::move(_1);
 
  // Semantic action epilogue.
 PUSH_VR();
@@ -702,7 +874,7 @@ void _handler4(yyparse& parser) {
 // Semantic action prologue.
 auto _1 = POP_T();
 
-auto __ = Exp(std::stoi(_1)) ;
+auto __ = ast().number(_1) ;
 
  // Semantic action epilogue.
 PUSH_VR();
@@ -713,7 +885,7 @@ void _handler5(yyparse& parser) {
 // Semantic action prologue.
 auto _1 = POP_T();
 
-auto __ = Exp(_1) ;
+auto __ = ast().string(_1) ;
 
  // Semantic action epilogue.
 PUSH_VR();
@@ -724,7 +896,7 @@ void _handler6(yyparse& parser) {
 // Semantic action prologue.
 auto _1 = POP_T();
 
-auto __ = Exp(_1) ;
+auto __ = ast().symbol(_1) ;
 
  // Semantic action epilogue.
 PUSH_VR();
@@ -737,7 +909,7 @@ parser.tokensStack.pop_back();
 auto _2 = POP_V();
 parser.tokensStack.pop_back();
 
-auto __ = _2 ;
+auto __ = ast().endList(_2) ;
 
  // Semantic action epilogue.
 PUSH_VR();
@@ -748,7 +920,7 @@ void _handler8(yyparse& parser) {
 // Semantic action prologue.
 
 
-auto __ = Exp(std::vector<Exp>{}) ;
+auto __ = ast().beginList() ;
 
  // Semantic action epilogue.
 PUSH_VR();
@@ -760,7 +932,7 @@ void _handler9(yyparse& parser) {
 auto _2 = POP_V();
 auto _1 = POP_V();
 
-_1.list.push_back(_2); auto __ = _1 ;
+ast().appendToList(_2); auto __ = _1 ;
 
  // Semantic action epilogue.
 PUSH_VR();
@@ -780,25 +952,6 @@ std::array<Production, yyparse::PRODUCTIONS_COUNT> yyparse::productions_ = {{{-1
 {3, 2, &_handler9}}};
 // clang-format on
 
-// ------------------------------------------------------------------
-// Parsing table.
-
-// clang-format off
-std::array<Row, yyparse::ROWS_COUNT> yyparse::table_ = {
-    Row {{0, {TE::Transit, 1}}, {1, {TE::Transit, 2}}, {2, {TE::Transit, 3}}, {4, {TE::Shift, 4}}, {5, {TE::Shift, 5}}, {6, {TE::Shift, 6}}, {7, {TE::Shift, 7}}},
-    Row {{9, {TE::Accept, 0}}},
-    Row {{4, {TE::Reduce, 1}}, {5, {TE::Reduce, 1}}, {6, {TE::Reduce, 1}}, {7, {TE::Reduce, 1}}, {8, {TE::Reduce, 1}}, {9, {TE::Reduce, 1}}},
-    Row {{4, {TE::Reduce, 2}}, {5, {TE::Reduce, 2}}, {6, {TE::Reduce, 2}}, {7, {TE::Reduce, 2}}, {8, {TE::Reduce, 2}}, {9, {TE::Reduce, 2}}},
-    Row {{4, {TE::Reduce, 3}}, {5, {TE::Reduce, 3}}, {6, {TE::Reduce, 3}}, {7, {TE::Reduce, 3}}, {8, {TE::Reduce, 3}}, {9, {TE::Reduce, 3}}},
-    Row {{4, {TE::Reduce, 4}}, {5, {TE::Reduce, 4}}, {6, {TE::Reduce, 4}}, {7, {TE::Reduce, 4}}, {8, {TE::Reduce, 4}}, {9, {TE::Reduce, 4}}},
-    Row {{4, {TE::Reduce, 5}}, {5, {TE::Reduce, 5}}, {6, {TE::Reduce, 5}}, {7, {TE::Reduce, 5}}, {8, {TE::Reduce, 5}}, {9, {TE::Reduce, 5}}},
-    Row {{3, {TE::Transit, 8}}, {4, {TE::Reduce, 7}}, {5, {TE::Reduce, 7}}, {6, {TE::Reduce, 7}}, {7, {TE::Reduce, 7}}, {8, {TE::Reduce, 7}}},
-    Row {{0, {TE::Transit, 10}}, {1, {TE::Transit, 2}}, {2, {TE::Transit, 3}}, {4, {TE::Shift, 4}}, {5, {TE::Shift, 5}}, {6, {TE::Shift, 6}}, {7, {TE::Shift, 7}}, {8, {TE::Shift, 9}}},
-    Row {{4, {TE::Reduce, 6}}, {5, {TE::Reduce, 6}}, {6, {TE::Reduce, 6}}, {7, {TE::Reduce, 6}}, {8, {TE::Reduce, 6}}, {9, {TE::Reduce, 6}}},
-    Row {{4, {TE::Reduce, 8}}, {5, {TE::Reduce, 8}}, {6, {TE::Reduce, 8}}, {7, {TE::Reduce, 8}}, {8, {TE::Reduce, 8}}}
-};
-// clang-format on
-
 }  // namespace syntax
 
 #endif
\ No newline at end of file
@@ -0,0 +1,520 @@
+/**
+ * Hand-written DFA tokenizer for the Eva grammar.
+ *
+ * Replaces the generic regex-based tokenizer of the Syntax tool. It is
+ * plugged in at generation time, so it survives parser regeneration
+ * (see EvaParser.h for the full steps):
+ *
+ *   syntax-cli \
+ *     --grammar src/parser/EvaGrammar.bnf \
+ *     --mode LALR1 \
+ *     --custom-tokenizer src/parser/EvaTokenizer.h \
+ *     --output src/parser/EvaParser.h
+ *
+ * Recognizes the same token set as the `%lex` section of EvaGrammar.bnf
+ * (parens, comments, whitespace, STRING, NUMBER, SYMBOL) in a single
+ * linear pass over the source buffer, without a regex engine. Runs of
+ * whitespace, digits and symbol chars, and string and line comment
+ * bodies, are skipped a 64-byte block at a time using the SIMD class
+ * bitmasks from StructuralIndex.h.
+ *
+ * Note: this file is inserted into the generated parser inside the
+ * `syntax` namespace, so it must not include any headers; the headers it
+ * needs come from the parser template and grammar prologue.
+ */
+
+#ifndef __Syntax_Tokenizer_h
+#define __Syntax_Tokenizer_h
+
+class Tokenizer;
+
+// ------------------------------------------------------------------
+// TokenType.
+//
+// The numbers are the grammar symbol encoding used by the parsing
+// table, and must match the ones syntax-cli assigns for EvaGrammar.bnf.
+
+enum class TokenType {
+  __EMPTY = -1,
+  // clang-format off
+  NUMBER = 4,
+  STRING = 5,
+  SYMBOL = 6,
+  TOKEN_TYPE_7 = 7,
+  TOKEN_TYPE_8 = 8,
+  __EOF = 9
+  // clang-format on
+};
+
+// ------------------------------------------------------------------
+// Token.
+//
+// Plain value record: `value` is a view into the tokenizer's source
+// buffer, which must outlive the token. Line and column are not tracked
+// per token; they are computed from the offsets by `Tokenizer::locate`
+// only when a diagnostic needs them.
+
+struct Token {
+  TokenType type;
+  std::string_view value;
+
+  int startOffset;
+  int endOffset;
+};
+
+// ------------------------------------------------------------------
+// Line-based location of an offset.
+
+struct Location {
+  int line;
+  int column;
+};
+
+// ------------------------------------------------------------------
+// Character classes (DFA input alphabet).
+
+enum class CharClass : unsigned char {
+  Other,
+  Space,   // \s
+  Digit,   // \d
+  Symbol,  // [\w\-+*=!<>] minus digits
+  Slash,   // `/`: comment start, or a symbol char
+  Quote,   // `"`
+  LParen,  // `(`
+  RParen,  // `)`
+};
+
+struct CharClassTable {
+  CharClass classes[256];
+};
+
+constexpr CharClassTable makeCharClassTable() {
+  CharClassTable table{};
+
+  for (int c = 0; c < 256; c++) {
+    table.classes[c] = CharClass::Other;
+  }
+
+  for (int c = 'a'; c <= 'z'; c++) {
+    table.classes[c] = CharClass::Symbol;
+  }
+  for (int c = 'A'; c <= 'Z'; c++) {
+    table.classes[c] = CharClass::Symbol;
+  }
+  for (int c = '0'; c <= '9'; c++) {
+    table.classes[c] = CharClass::Digit;
+  }
+
+  table.classes[(unsigned char)'_'] = CharClass::Symbol;
+  table.classes[(unsigned char)'-'] = CharClass::Symbol;
+  table.classes[(unsigned char)'+'] = CharClass::Symbol;
+  table.classes[(unsigned char)'*'] = CharClass::Symbol;
+  table.classes[(unsigned char)'='] = CharClass::Symbol;
+  table.classes[(unsigned char)'!'] = CharClass::Symbol;
+  table.classes[(unsigned char)'<'] = CharClass::Symbol;
+  table.classes[(unsigned char)'>'] = CharClass::Symbol;
+
+  table.classes[(unsigned char)' '] = CharClass::Space;
+  table.classes[(unsigned char)'\t'] = CharClass::Space;
+  table.classes[(unsigned char)'\n'] = CharClass::Space;
+  table.classes[(unsigned char)'\v'] = CharClass::Space;
+  table.classes[(unsigned char)'\f'] = CharClass::Space;
+  table.classes[(unsigned char)'\r'] = CharClass::Space;
+
+  table.classes[(unsigned char)'/'] = CharClass::Slash;
+  table.classes[(unsigned char)'"'] = CharClass::Quote;
+  table.classes[(unsigned char)'('] = CharClass::LParen;
+  table.classes[(unsigned char)')'] = CharClass::RParen;
+
+  return table;
+}
+
+constexpr CharClassTable kCharClasses = makeCharClassTable();
+
+inline CharClass charClass(char c) {
+  return kCharClasses.classes[(unsigned char)c];
+}
+
+/**
+ * Whether a char continues a SYMBOL: [\w\-+*=!<>/].
+ */
+inline bool isSymbolChar(char c) {
+  auto cc = charClass(c);
+  return cc == CharClass::Symbol || cc == CharClass::Digit ||
+         cc == CharClass::Slash;
+}
+
+inline bool isSpaceChar(char c) { return charClass(c) == CharClass::Space; }
+
+inline bool isDigitChar(char c) { return charClass(c) == CharClass::Digit; }
+
+// ------------------------------------------------------------------
+// Tokenizer state.
+
+enum TokenizerState {
+  // clang-format off
+  INITIAL
+  // clang-format on
+};
+
+// ------------------------------------------------------------------
+// Tokenizer.
+
+class Tokenizer {
+ public:
+  /**
+   * Initializes a parsing string. The string is not copied, and must
+   * outlive the tokenizer and the tokens it returns.
+   *
+   * `origin` is the location of the string in its source, when it is cut
+   * out of a larger one (a top-level form), so that diagnostics give
+   * locations in the source.
+   */
+  void initString(std::string_view str, Location origin = {1, 0}) {
+    str_ = str;
+    origin_ = origin;
+
+    // Initialize states.
+    states_.clear();
+    states_.push_back(TokenizerState::INITIAL);
+
+    cursor_ = 0;
+    std::fill(std::begin(blockStarts_), std::end(blockStarts_), -1);
+  }
+
+  /**
+   * Whether there are still tokens in the stream.
+   */
+  inline bool hasMoreTokens() { return cursor_ <= (int)str_.length(); }
+
+  /**
+   * Returns current tokenizing state.
+   */
+  TokenizerState getCurrentState() { return states_.back(); }
+
+  /**
+   * Enters a new state pushing it on the states stack.
+   */
+  void pushState(TokenizerState state) { states_.push_back(state); }
+
+  /**
+   * Alias for `push_state`.
+   */
+  void begin(TokenizerState state) { states_.push_back(state); }
+
+  /**
+   * Exits a current state popping it from the states stack.
+   */
+  TokenizerState popState() {
+    auto state = states_.back();
+    states_.pop_back();
+    return state;
+  }
+
+  /**
+   * Returns next token. Whitespace and comments are skipped in a loop.
+   */
+  Token getNextToken() {
+    for (;;) {
+      if (!hasMoreTokens()) {
+        yytext = __EOF;
+        return Token{TokenType::__EOF, yytext, cursor_, cursor_};
+      }
+
+      if (isEOF()) {
+        auto offset = cursor_++;
+        yytext = __EOF;
+        return Token{TokenType::__EOF, yytext, offset, offset};
+      }
+
+      auto start = cursor_;
+      auto tokenType = scan_();
+
+      if (tokenType != TokenType::__EMPTY) {
+        yytext = str_.substr(start, cursor_ - start);
+        return Token{tokenType, yytext, start, cursor_};
+      }
+    }
+  }
+
+  /**
+   * Whether the cursor is at the EOF.
+   */
+  inline bool isEOF() { return cursor_ == (int)str_.length(); }
+
+  /**
+   * Computes the line-based location of an offset, in the source of the
+   * string. This rescans the string up to the offset, and is meant for
+   * diagnostics only.
+   */
+  Location locate(int offset) const {
+    return advance(origin_, str_.substr(0, std::max(offset, 0)));
+  }
+
+  /**
+   * Location after `text`, which starts at `location`.
+   */
+  static Location advance(Location location, std::string_view text) {
+    for (auto c : text) {
+      if (c == '\n') {
+        location.line++;
+        location.column = 0;
+      } else {
+        location.column++;
+      }
+    }
+    return location;
+  }
+
+  /**
+   * Throws default "Unexpected token" exception for the token at
+   * the offset.
+   */
+  [[noreturn]] void throwUnexpectedToken(std::string_view symbol,
+                                         int offset) {
+    auto location = locate(offset);
+    throwUnexpectedToken(symbol, location.line, location.column);
+  }
+
+  /**
+   * Throws default "Unexpected token" exception, showing the actual
+   * line from the source, pointing with the ^ marker to the bad token.
+   * In addition, shows `line:column` location.
+   */
+  [[noreturn]] void throwUnexpectedToken(std::string_view symbol, int line,
+                                         int column) {
+    std::stringstream ss{std::string(str_)};
+    std::string lineStr;
+    int currentLine = origin_.line;
+
+    while (currentLine++ <= line) {
+      std::getline(ss, lineStr, '\n');
+    }
+
+    // The first line of the string starts at the origin's column.
+    auto pad = std::string(
+        std::max(line == origin_.line ? column - origin_.column : column, 0),
+        ' ');
+
+    std::stringstream errMsg;
+
+    errMsg << "Syntax Error:\n\n"
+           << lineStr << "\n"
+           << pad << "^\nUnexpected token \"" << symbol << "\" at " << line
+           << ":" << column << "\n\n";
+
+    std::cerr << errMsg.str();
+    throw new std::runtime_error(errMsg.str().c_str());
+  }
+
+  /**
+   * Matched text (a view into the source buffer).
+   */
+  std::string_view yytext;
+
+ private:
+  /**
+   * Runs the DFA from the cursor, advancing it past the longest match.
+   * Returns the matched token type, or `__EMPTY` for skipped input
+   * (whitespace and comments).
+   *
+   * Mirrors the first-match order of the lex rules in the grammar:
+   * `(`, `)`, line comment, block comment, whitespace, STRING, NUMBER,
+   * SYMBOL.
+   */
+  TokenType scan_() {
+    const auto length = (int)str_.length();
+    auto c = str_[cursor_];
+
+    switch (charClass(c)) {
+      // (
+      case CharClass::LParen:
+        cursor_++;
+        return TokenType::TOKEN_TYPE_7;
+
+      // )
+      case CharClass::RParen:
+        cursor_++;
+        return TokenType::TOKEN_TYPE_8;
+
+      // \s+
+      case CharClass::Space:
+        cursor_ = skipRun_<StructuralClass::Space, isSpaceChar>(cursor_ + 1);
+        return TokenType::__EMPTY;
+
+      // \"(\\.|[^\"\\])*\"
+      case CharClass::Quote: {
+        auto end = cursor_;
+        do {
+          end = findNext_<StructuralClass::Quote>(end + 1);
+        } while (end < length && isEscaped_(end));
+        if (end == length) {
+          throwUnexpectedToken("\"", cursor_);
+        }
+        cursor_ = end + 1;
+        return TokenType::STRING;
+      }
+
+      // \d+(\.\d+)?
+      case CharClass::Digit:
+        cursor_ = skipRun_<StructuralClass::Digit, isDigitChar>(cursor_ + 1);
+        if (cursor_ + 1 < length && str_[cursor_] == '.' &&
+            isDigitChar(str_[cursor_ + 1])) {
+          cursor_ = skipRun_<StructuralClass::Digit, isDigitChar>(cursor_ + 2);
+        }
+        return TokenType::NUMBER;
+
+      // \/\/.* and \/\*[\s\S]*?\*\/, otherwise a symbol.
+      case CharClass::Slash:
+        if (cursor_ + 1 < length && str_[cursor_ + 1] == '/') {
+          cursor_ = findNext_<StructuralClass::LineEnd>(cursor_ + 2);
+          return TokenType::__EMPTY;
+        }
+        if (cursor_ + 1 < length && str_[cursor_ + 1] == '*') {
+          auto end = str_.find("*/", cursor_ + 2);
+          if (end != std::string_view::npos) {
+            cursor_ = end + 2;
+            return TokenType::__EMPTY;
+          }
+        }
+        return scanSymbol_();
+
+      // [\w\-+*=!<>/]+
+      case CharClass::Symbol:
+        return scanSymbol_();
+
+      default:
+        throwUnexpectedToken(str_.substr(cursor_, 1), cursor_);
+    }
+  }
+
+  /**
+   * Consumes a run of symbol chars.
+   */
+  TokenType scanSymbol_() {
+    cursor_ = skipRun_<StructuralClass::Symbol, isSymbolChar>(cursor_ + 1);
+    return TokenType::SYMBOL;
+  }
+
+  /**
+   * Whether the char at `offset` in a string is escaped: preceded by an
+   * odd number of backslashes.
+   */
+  bool isEscaped_(int offset) const {
+    auto backslashes = 0;
+    while (str_[offset - backslashes - 1] == '\\') {
+      backslashes++;
+    }
+    return backslashes % 2 == 1;
+  }
+
+  /**
+   * Returns the end of the run of chars in a class starting at `from`:
+   * the first offset not in the class, or the string length.
+   */
+  template <StructuralClass cls, bool (*inClass)(char)>
+  int skipRun_(int from) {
+    const auto length = (int)str_.length();
+
+    // Most runs end right away (single-char separators, short numbers):
+    // check the next char directly before going to the block masks.
+    if (from >= length || !inClass(str_[from])) {
+      return from;
+    }
+
+    while (from < length) {
+      auto start = blockStart_(from);
+      auto outside = ~blockMask_<cls>(start) >> (from - start);
+
+      // Bits shifted in at the top are zero, i.e. "in the class": when no
+      // bit is left, the run continues into the next block.
+      if (outside != 0) {
+        return std::min(from + (int)lowestBit(outside), length);
+      }
+      from = start + (int)STRUCTURAL_BLOCK_SIZE;
+    }
+
+    return length;
+  }
+
+  /**
+   * Returns the first offset from `from` with a char in a class, or the
+   * string length if there is none.
+   */
+  template <StructuralClass cls>
+  int findNext_(int from) {
+    const auto length = (int)str_.length();
+
+    while (from < length) {
+      auto start = blockStart_(from);
+      auto inside = blockMask_<cls>(start) >> (from - start);
+
+      if (inside != 0) {
+        return from + (int)lowestBit(inside);
+      }
+      from = start + (int)STRUCTURAL_BLOCK_SIZE;
+    }
+
+    return length;
+  }
+
+  /**
+   * Start of the 64-byte block containing `offset`.
+   */
+  static int blockStart_(int offset) {
+    return offset & ~(int)(STRUCTURAL_BLOCK_SIZE - 1);
+  }
+
+  /**
+   * Class mask of the block at `start`. A block is classified once per
+   * class, when the cursor first needs that class in it.
+   */
+  template <StructuralClass cls>
+  uint64_t blockMask_(int start) {
+    auto index = (size_t)cls;
+
+    if (start != blockStarts_[index]) {
+      blockStarts_[index] = start;
+      auto available = str_.length() - start;
+      blockMasks_[index] =
+          available >= STRUCTURAL_BLOCK_SIZE
+              ? classifyBlock<cls>(str_.data() + start)
+              : classifyPartialBlock<cls>(str_.data() + start, available);
+    }
+
+    return blockMasks_[index];
+  }
+
+  /**
+   * Special EOF token.
+   */
+  static constexpr std::string_view __EOF = "$";
+
+  /**
+   * Tokenizing string (not owned).
+   */
+  std::string_view str_;
+
+  /**
+   * Location of the string in its source.
+   */
+  Location origin_{1, 0};
+
+  /**
+   * Cursor for current symbol.
+   */
+  int cursor_;
+
+  /**
+   * States.
+   */
+  std::vector<TokenizerState> states_;
+
+  /**
+   * Per class: mask of the last classified block, and its offset.
+   */
+  uint64_t blockMasks_[STRUCTURAL_CLASSES_COUNT];
+  int blockStarts_[STRUCTURAL_CLASSES_COUNT];
+};
+
+#endif
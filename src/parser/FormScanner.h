@@ -0,0 +1,297 @@
+/**
+ * Structural scanner for top-level forms.
+ *
+ * Finds the boundaries of top-level forms (lists and atoms) by tracking
+ * paren depth, while skipping strings and comments with the same rules
+ * as the tokenizer. It does not build tokens, so it is much cheaper than
+ * parsing, and it can be resumed as more input arrives.
+ */
+
+#ifndef FormScanner_h
+#define FormScanner_h
+
+#include <algorithm>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "./EvaParser.h"
+
+namespace syntax {
+
+/**
+ * Source range [start, end) of a top-level form.
+ */
+struct FormRange {
+  size_t start;
+  size_t end;
+};
+
+class FormScanner {
+ public:
+  /**
+   * Scans `text` from where the previous call stopped and finds the next
+   * complete top-level form. Returns false if more input is needed, or,
+   * when `eof` is set, if there are no more forms.
+   *
+   * The text must start with what was passed before (it may grow between
+   * calls); use `consume` after dropping a prefix of it.
+   *
+   * Malformed input (unbalanced parens, an unterminated string) is still
+   * split into forms, so that the parser reports the error.
+   */
+  bool next(std::string_view text, bool eof, FormRange& form) {
+    for (;;) {
+      while (cursor_ < text.size()) {
+        auto c = text[cursor_];
+
+        switch (state_) {
+          case State::Between:
+            if (!scanBetween_(text, eof, form)) {
+              return false;
+            }
+            if (formDone_) {
+              formDone_ = false;
+              return true;
+            }
+            break;
+
+          case State::Number:
+          case State::Symbol:
+            // A decimal point continues a number if a digit follows it.
+            if (state_ == State::Number && c == '.') {
+              if (cursor_ + 1 == text.size() && !eof) {
+                return false;
+              }
+              if (cursor_ + 1 < text.size() &&
+                  charClass(text[cursor_ + 1]) == CharClass::Digit) {
+                cursor_ += 2;
+                break;
+              }
+            }
+            if (state_ == State::Number ? charClass(c) == CharClass::Digit
+                                        : isSymbolChar(c)) {
+              cursor_++;
+              break;
+            }
+            state_ = State::Between;
+            if (depth_ == 0) {
+              form = FormRange{formStart_, cursor_};
+              return true;
+            }
+            break;
+
+          case State::String:
+            if (c == '\\') {
+              // Escape: skip the next char, once it is read.
+              if (cursor_ + 1 == text.size() && !eof) {
+                return false;
+              }
+              cursor_ = std::min(cursor_ + 2, text.size());
+              break;
+            }
+            cursor_++;
+            if (c == '"') {
+              state_ = State::Between;
+              if (depth_ == 0) {
+                form = FormRange{formStart_, cursor_};
+                return true;
+              }
+            }
+            break;
+
+          case State::LineComment:
+            if (c == '\n' || c == '\r') {
+              state_ = State::Between;
+            }
+            cursor_++;
+            break;
+
+          case State::BlockComment:
+            if (c == '*') {
+              if (cursor_ + 1 == text.size() && !eof) {
+                return false;
+              }
+              if (cursor_ + 1 < text.size() && text[cursor_ + 1] == '/') {
+                state_ = State::Between;
+                cursor_++;
+              }
+            }
+            cursor_++;
+            break;
+        }
+      }
+
+      if (!eof) {
+        return false;
+      }
+
+      // An unterminated block comment is a symbol for the tokenizer:
+      // rescan it as one.
+      if (state_ == State::BlockComment) {
+        cursor_ = commentStart_ + 1;
+        state_ = State::Symbol;
+        continue;
+      }
+
+      // End of input: a pending atom ends here, and anything left unclosed
+      // becomes a final form for the parser to reject.
+      auto pending = depth_ > 0 || (state_ != State::Between &&
+                                    state_ != State::LineComment);
+      state_ = State::Between;
+      depth_ = 0;
+
+      if (pending && formStart_ < text.size()) {
+        form = FormRange{formStart_, text.size()};
+        formStart_ = text.size();
+        return true;
+      }
+      return false;
+    }
+  }
+
+  /**
+   * Adjusts the scanner after the first `count` bytes of the text were
+   * dropped (they must not include the form being scanned).
+   */
+  void consume(size_t count) {
+    cursor_ -= count;
+    formStart_ = formStart_ >= count ? formStart_ - count : 0;
+    commentStart_ = commentStart_ >= count ? commentStart_ - count : 0;
+  }
+
+  /**
+   * Splits a complete source into its top-level forms.
+   */
+  static std::vector<FormRange> split(std::string_view text) {
+    FormScanner scanner;
+    std::vector<FormRange> forms;
+    FormRange form;
+    while (scanner.next(text, /* eof */ true, form)) {
+      forms.push_back(form);
+    }
+    return forms;
+  }
+
+ private:
+  enum class State {
+    Between,
+    Number,
+    Symbol,
+    String,
+    LineComment,
+    BlockComment,
+  };
+
+  /**
+   * Handles a char between tokens. Returns false if the char cannot be
+   * classified without more input. Sets `formDone_` when it closes a
+   * top-level form.
+   */
+  bool scanBetween_(std::string_view text, bool eof, FormRange& form) {
+    auto c = text[cursor_];
+
+    switch (charClass(c)) {
+      case CharClass::Space:
+        cursor_++;
+        return true;
+
+      case CharClass::LParen:
+        startToken_();
+        depth_++;
+        cursor_++;
+        return true;
+
+      case CharClass::RParen:
+        // Unbalanced `)` at the top level is a form of its own.
+        if (depth_ == 0) {
+          formStart_ = cursor_;
+        } else {
+          depth_--;
+        }
+        cursor_++;
+        if (depth_ == 0) {
+          form = FormRange{formStart_, cursor_};
+          formDone_ = true;
+        }
+        return true;
+
+      case CharClass::Quote:
+        startToken_();
+        state_ = State::String;
+        cursor_++;
+        return true;
+
+      case CharClass::Digit:
+        startToken_();
+        state_ = State::Number;
+        cursor_++;
+        return true;
+
+      case CharClass::Slash:
+        if (cursor_ + 1 == text.size() && !eof) {
+          return false;
+        }
+        if (cursor_ + 1 < text.size() && text[cursor_ + 1] == '/') {
+          state_ = State::LineComment;
+          cursor_ += 2;
+          return true;
+        }
+        if (cursor_ + 1 < text.size() && text[cursor_ + 1] == '*') {
+          startToken_();
+          commentStart_ = cursor_;
+          state_ = State::BlockComment;
+          cursor_ += 2;
+          return true;
+        }
+        startToken_();
+        state_ = State::Symbol;
+        cursor_++;
+        return true;
+
+      default:
+        // Symbols, and invalid chars which the tokenizer reports.
+        startToken_();
+        state_ = State::Symbol;
+        cursor_++;
+        return true;
+    }
+  }
+
+  /**
+   * Records the start of a top-level form.
+   */
+  void startToken_() {
+    if (depth_ == 0) {
+      formStart_ = cursor_;
+    }
+  }
+
+  State state_ = State::Between;
+
+  /**
+   * Paren depth at the cursor.
+   */
+  int depth_ = 0;
+
+  /**
+   * Next char to scan.
+   */
+  size_t cursor_ = 0;
+
+  /**
+   * Start of the top-level form being scanned.
+   */
+  size_t formStart_ = 0;
+
+  /**
+   * Start of the block comment being scanned.
+   */
+  size_t commentStart_ = 0;
+
+  bool formDone_ = false;
+};
+
+}  // namespace syntax
+
+#endif
@@ -0,0 +1,202 @@
+/**
+ * SIMD character classification for the Eva tokenizer.
+ *
+ * In the spirit of simdjson's structural indexing: a 64-byte block of the
+ * source is classified at once into a bitmask (bit i is byte i of the
+ * block) of whitespace, digits, symbol chars, quotes or line ends. The
+ * tokenizer then finds the end of a run, or the next quote or line end,
+ * with a single count-trailing-zeros instead of stepping byte by byte.
+ *
+ * Each class is computed on its own, when the tokenizer first needs it
+ * in a block, so a block of plain words never pays for the quote mask.
+ *
+ * Uses AVX2 or SSE2 when the target supports them, with a scalar
+ * fallback.
+ */
+
+#ifndef StructuralIndex_h
+#define StructuralIndex_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Char classes of the structural index.
+ */
+enum class StructuralClass {
+    // \s
+    Space,
+
+    // \d
+    Digit,
+
+    // [\w\-+*=!<>/]
+    Symbol,
+
+    // "
+    Quote,
+
+    // \n, \r
+    LineEnd,
+};
+
+constexpr size_t STRUCTURAL_CLASSES_COUNT = 5;
+
+/**
+ * Block size of the structural index.
+ */
+constexpr size_t STRUCTURAL_BLOCK_SIZE = 64;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+
+#if defined(__AVX2__)
+using SimdBytes = __m256i;
+constexpr size_t SIMD_WIDTH = 32;
+
+inline SimdBytes simdLoad(const char* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+inline SimdBytes simdSplat(char c) { return _mm256_set1_epi8(c); }
+inline SimdBytes simdEq(SimdBytes a, SimdBytes b) { return _mm256_cmpeq_epi8(a, b); }
+inline SimdBytes simdOr(SimdBytes a, SimdBytes b) { return _mm256_or_si256(a, b); }
+inline SimdBytes simdSub(SimdBytes a, SimdBytes b) { return _mm256_sub_epi8(a, b); }
+inline SimdBytes simdMinU(SimdBytes a, SimdBytes b) { return _mm256_min_epu8(a, b); }
+inline uint64_t simdMask(SimdBytes a) { return (uint32_t)_mm256_movemask_epi8(a); }
+#else
+using SimdBytes = __m128i;
+constexpr size_t SIMD_WIDTH = 16;
+
+inline SimdBytes simdLoad(const char* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+inline SimdBytes simdSplat(char c) { return _mm_set1_epi8(c); }
+inline SimdBytes simdEq(SimdBytes a, SimdBytes b) { return _mm_cmpeq_epi8(a, b); }
+inline SimdBytes simdOr(SimdBytes a, SimdBytes b) { return _mm_or_si128(a, b); }
+inline SimdBytes simdSub(SimdBytes a, SimdBytes b) { return _mm_sub_epi8(a, b); }
+inline SimdBytes simdMinU(SimdBytes a, SimdBytes b) { return _mm_min_epu8(a, b); }
+inline uint64_t simdMask(SimdBytes a) { return (uint16_t)_mm_movemask_epi8(a); }
+#endif
+
+/**
+ * Bytes in the range [lo, hi]: (c - lo) <= (hi - lo) as unsigned bytes.
+ */
+inline SimdBytes simdInRange(SimdBytes bytes, char lo, char hi) {
+    auto offset = simdSub(bytes, simdSplat(lo));
+    return simdEq(simdMinU(offset, simdSplat((char)(hi - lo))), offset);
+}
+
+/**
+ * Bytes of a class in one vector.
+ */
+template <StructuralClass cls>
+inline SimdBytes simdClassify(SimdBytes bytes) {
+    switch (cls) {
+        case StructuralClass::Space:
+            // ' ', and \t \n \v \f \r
+            return simdOr(simdEq(bytes, simdSplat(' ')),
+                          simdInRange(bytes, '\t', '\r'));
+
+        case StructuralClass::Digit:
+            return simdInRange(bytes, '0', '9');
+
+        case StructuralClass::Symbol: {
+            // Letters: fold case by setting 0x20.
+            auto symbol = simdOr(simdInRange(bytes, '0', '9'),
+                                 simdInRange(simdOr(bytes, simdSplat(0x20)), 'a', 'z'));
+            symbol = simdOr(symbol, simdOr(simdEq(bytes, simdSplat('_')),
+                                           simdEq(bytes, simdSplat('-'))));
+            // '*' and '+' are adjacent, so are '<', '=' and '>'.
+            symbol = simdOr(symbol, simdOr(simdInRange(bytes, '*', '+'),
+                                           simdInRange(bytes, '<', '>')));
+            return simdOr(symbol, simdOr(simdEq(bytes, simdSplat('!')),
+                                         simdEq(bytes, simdSplat('/'))));
+        }
+
+        case StructuralClass::Quote:
+            return simdEq(bytes, simdSplat('"'));
+
+        case StructuralClass::LineEnd:
+            return simdOr(simdEq(bytes, simdSplat('\n')),
+                          simdEq(bytes, simdSplat('\r')));
+    }
+    return bytes;
+}
+
+/**
+ * Bitmask of the bytes of a class in the 64 bytes starting at `p`.
+ */
+template <StructuralClass cls>
+inline uint64_t classifyBlock(const char* p) {
+    uint64_t mask = 0;
+    for (size_t i = 0; i < STRUCTURAL_BLOCK_SIZE; i += SIMD_WIDTH) {
+        mask |= simdMask(simdClassify<cls>(simdLoad(p + i))) << i;
+    }
+    return mask;
+}
+
+#else
+
+/**
+ * Bitmask of the bytes of a class in the 64 bytes starting at `p`
+ * (scalar fallback).
+ */
+template <StructuralClass cls>
+inline uint64_t classifyBlock(const char* p) {
+    uint64_t mask = 0;
+
+    for (size_t i = 0; i < STRUCTURAL_BLOCK_SIZE; i++) {
+        auto c = (unsigned char)p[i];
+        auto lower = c | 0x20;
+        bool inClass = false;
+
+        switch (cls) {
+            case StructuralClass::Space:
+                inClass = c == ' ' || (c >= '\t' && c <= '\r');
+                break;
+            case StructuralClass::Digit:
+                inClass = c >= '0' && c <= '9';
+                break;
+            case StructuralClass::Symbol:
+                inClass = (c >= '0' && c <= '9') || (lower >= 'a' && lower <= 'z') ||
+                          c == '_' || c == '-' || c == '+' || c == '*' ||
+                          c == '=' || c == '!' || c == '<' || c == '>' ||
+                          c == '/';
+                break;
+            case StructuralClass::Quote:
+                inClass = c == '"';
+                break;
+            case StructuralClass::LineEnd:
+                inClass = c == '\n' || c == '\r';
+                break;
+        }
+
+        mask |= (uint64_t)inClass << i;
+    }
+
+    return mask;
+}
+
+#endif
+
+/**
+ * Classifies the last, partial block of a buffer: `size` < 64 bytes at
+ * `p`. The missing bytes belong to no class.
+ */
+template <StructuralClass cls>
+inline uint64_t classifyPartialBlock(const char* p, size_t size) {
+    char padded[STRUCTURAL_BLOCK_SIZE] = {0};
+    std::memcpy(padded, p, size);
+    return classifyBlock<cls>(padded);
+}
+
+/**
+ * Index of the lowest set bit (`bits` must not be zero).
+ */
+inline unsigned lowestBit(uint64_t bits) { return __builtin_ctzll(bits); }
+
+#endif
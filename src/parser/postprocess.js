@@ -0,0 +1,257 @@
+/**
+ * Post-generation step of EvaParser.h.
+ *
+ * Applies to the parser generated by syntax-cli the changes that the
+ * grammar and the custom tokenizer cannot express:
+ *
+ *   - a dense constexpr [state][symbol] parsing table with an explicit
+ *     `TE::Error` sentinel, instead of a `std::map` per row;
+ *
+ *   - `Token` values and `std::string_view` token text, as returned by
+ *     the tokenizer of EvaTokenizer.h, instead of shared tokens;
+ *
+ *   - semantic values moved, instead of copied, between the stacks;
+ *
+ *   - no `<regex>` include, which only the generic tokenizer needed.
+ *
+ * Run after syntax-cli, on its output (rewritten in place):
+ *
+ *   node src/parser/postprocess.js src/parser/EvaParser.h
+ *
+ * Every edit must match the generated code exactly once: if the Syntax
+ * tool's template changes, this fails instead of leaving a mix.
+ */
+'use strict';
+
+const fs = require('fs');
+
+const file = process.argv[2];
+if (!file) {
+  console.error('Usage: node postprocess.js <EvaParser.h>');
+  process.exit(1);
+}
+
+let source = fs.readFileSync(file, 'utf8');
+
+/**
+ * Replaces the single occurrence of `from`.
+ */
+function edit(from, to) {
+  const index = source.indexOf(from);
+  if (index < 0 || source.indexOf(from, index + 1) >= 0) {
+    console.error(`${file}: expected exactly one match of:\n${from}`);
+    process.exit(1);
+  }
+  source = source.slice(0, index) + to + source.slice(index + from.length);
+}
+
+// ------------------------------------------------------------------
+// Header and includes.
+
+edit(
+  ` * To regenerate run:
+ *
+ *   syntax-cli \\
+ *     --grammar ~/path-to-grammar-file \\
+ *     --mode <parsing-mode> \\
+ *     --output ~/ParserClassName.h
+ */`,
+  ` * To regenerate run:
+ *
+ *   syntax-cli \\
+ *     --grammar src/parser/EvaGrammar.bnf \\
+ *     --mode LALR1 \\
+ *     --custom-tokenizer src/parser/EvaTokenizer.h \\
+ *     --output src/parser/EvaParser.h
+ *   node src/parser/postprocess.js src/parser/EvaParser.h
+ *
+ * The second step rewrites the generated code for the dense parsing
+ * table and the tokenizer's tokens, see postprocess.js. Do not edit this
+ * file by hand.
+ */`);
+
+edit('#include <regex>\n', '');
+
+// ------------------------------------------------------------------
+// Moved semantic values.
+
+edit(
+  `#define POP_V()              \\
+  parser.valuesStack.back(); \\
+  parser.valuesStack.pop_back()`,
+  `#define POP_V()                         \\
+  std::move(parser.valuesStack.back()); \\
+  parser.valuesStack.pop_back()`);
+
+edit(
+  '#define PUSH_VR() parser.valuesStack.push_back(__)',
+  '#define PUSH_VR() parser.valuesStack.push_back(std::move(__))');
+
+edit(
+  'auto result = valuesStack.back(); valuesStack.pop_back();',
+  'auto result = std::move(valuesStack.back()); valuesStack.pop_back();');
+
+// Default actions (`$$ = $1`) of productions without one.
+source = source.replace(/^auto __ = (_\d+);$/gm, 'auto __ = std::move($1);');
+
+// ------------------------------------------------------------------
+// Tokens.
+
+edit(
+  `  /**
+   * Token values stack.
+   */
+  std::vector<std::string> tokensStack;`,
+  `  /**
+   * Token values stack (views into the parsing string).
+   */
+  std::vector<std::string_view> tokensStack;`);
+
+edit('auto column = (int)token->type;', 'auto column = (int)token.type;');
+edit('tokensStack.push_back(token->value);', 'tokensStack.push_back(token.value);');
+edit('tokenizer.yytext = shiftedToken->value;', 'tokenizer.yytext = shiftedToken.value;');
+
+edit(
+  `  [[noreturn]] void throwUnexpectedToken(SharedToken token) {
+    if (token->type == TokenType::__EOF && !tokenizer.hasMoreTokens()) {`,
+  `  [[noreturn]] void throwUnexpectedToken(const Token& token) {
+    if (token.type == TokenType::__EOF && !tokenizer.hasMoreTokens()) {`);
+
+edit(
+  `    tokenizer.throwUnexpectedToken(token->value, token->startLine,
+                                   token->startColumn);`,
+  '    tokenizer.throwUnexpectedToken(token.value, token.startOffset);');
+
+// ------------------------------------------------------------------
+// Dense parsing table.
+
+const tableMatch = source.match(
+  /\n\/\/ -+\n\/\/ Parsing table\.\n\n\/\/ clang-format off\nstd::array<Row, yyparse::ROWS_COUNT> yyparse::table_ = \{\n([\s\S]*?)\n\};\n\/\/ clang-format on\n/);
+if (!tableMatch) {
+  console.error(`${file}: parsing table not found`);
+  process.exit(1);
+}
+source = source.replace(tableMatch[0], '');
+
+// Rows: `Row {{column, {TE::Type, value}}, ...}`, columns are encoded
+// symbols; the end of input is the last one.
+const rows = tableMatch[1].split('\n').map(line => {
+  const cells = new Map();
+  for (const cell of line.matchAll(/\{(\d+), \{(TE::\w+), (\d+)\}\}/g)) {
+    cells.set(Number(cell[1]), `{${cell[2]}, ${cell[3]}}`);
+  }
+  return cells;
+});
+const columnsCount = 1 + Math.max(...rows.map(cells => Math.max(...cells.keys())));
+const denseRows = rows.map(cells => {
+  const entries = [];
+  for (let column = 0; column < columnsCount; column++) {
+    entries.push(cells.get(column) || '{TE::Error, 0}');
+  }
+  return `      {${entries.join(', ')}}`;
+});
+
+const counts = source.match(
+  /  \/\/ clang-format off\n  static constexpr size_t PRODUCTIONS_COUNT = (\d+);\n  static std::array<Production, PRODUCTIONS_COUNT> productions_;\n\n  static constexpr size_t ROWS_COUNT = (\d+);\n  static std::array<Row, ROWS_COUNT> table_;\n  \/\/ clang-format on\n/);
+if (!counts) {
+  console.error(`${file}: table sizes not found`);
+  process.exit(1);
+}
+edit(counts[0],
+  `  static std::array<Production, PRODUCTIONS_COUNT> productions_;
+
+  // Dense action/goto table: rows are states, columns are encoded
+  // symbols (terminals and non-terminals).
+  // clang-format off
+  static constexpr TableEntry table_[ROWS_COUNT][COLUMNS_COUNT] = {
+${denseRows.join(',\n')}
+  };
+  // clang-format on
+`);
+
+edit(
+  `  /**
+   * Parses a string.
+   */
+  Value parse(const std::string& str) {`,
+  `  // clang-format off
+  static constexpr size_t PRODUCTIONS_COUNT = ${counts[1]};
+  static constexpr size_t ROWS_COUNT = ${counts[2]};
+  static constexpr size_t COLUMNS_COUNT = ${columnsCount};
+  // clang-format on
+
+  /**
+   * Action for a state and an encoded symbol: a single load from
+   * the dense table.
+   */
+  static const TableEntry& action(int state, int symbol) {
+    return table_[state][symbol];
+  }
+
+  /**
+   * Encoded production by its number.
+   */
+  static const Production& production(int number) {
+    return productions_[number];
+  }
+
+  /**
+   * Parses a string. The string is not copied, and must stay alive
+   * for the duration of the call. \`origin\` is its location in the
+   * source, for syntax errors.
+   */
+  Value parse(std::string_view str, Location origin = {1, 0}) {`);
+
+edit('    tokenizer.initString(str);\n', '    tokenizer.initString(str, origin);\n');
+
+edit(
+  `enum class TE {
+  Accept,`,
+  `enum class TE : unsigned char {
+  Error,
+  Accept,`);
+
+edit(
+  `/**
+ * Parsing table entry.
+ */
+struct TableEntry {
+  TE type;
+  int value;
+};`,
+  `/**
+ * Parsing table entry. Cells with no action hold the \`TE::Error\`
+ * sentinel.
+ */
+struct TableEntry {
+  TE type;
+  unsigned short value;
+};`);
+
+edit(
+  `// Key: Encoded symbol (terminal or non-terminal) index
+// Value: TableEntry
+using Row = std::map<int, TableEntry>;
+
+`,
+  '');
+
+edit(
+  `      if (table_[state].count(column) == 0) {
+        throwUnexpectedToken(token);
+      }
+
+      auto entry = table_[state].at(column);
+`,
+  `      auto entry = table_[state][column];
+
+      if (entry.type == TE::Error) {
+        throwUnexpectedToken(token);
+      }
+`);
+
+edit(
+  'auto nextStateEntry = table_[previousState].at(symbolToReduceWith);',
+  'auto nextStateEntry = table_[previousState][symbolToReduceWith];');
+
+fs.writeFileSync(file, source);
@@ -0,0 +1,9 @@
+#!/bin/bash
+
+# Builds tests/EvaLLVM for the test scripts, with clang++ (override with
+# CXX and CXXFLAGS).
+
+cd "$(dirname "$0")/.."
+
+${CXX:-clang++} $(llvm-config --cxxflags) -std=c++17 -pthread -fexceptions ${CXXFLAGS} -o tests/EvaLLVM EvaLLVM.cpp \
+    $(llvm-config --ldflags --system-libs --libs core orcjit native passes bitreader bitwriter linker)
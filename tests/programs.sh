@@ -0,0 +1,34 @@
+#!/bin/bash
+
+# Runs the regression programs of tests/programs in JIT mode, at -O0 and
+# -O2, compiled in order, as parallel units and as lazy units, and checks
+# that each prints its .out file (stdout and stderr, without the
+# optimization time).
+# Builds tests/EvaLLVM first.
+#
+#   ./tests/programs.sh
+
+cd "$(dirname "$0")/.."
+
+./tests/build.sh || exit $?
+
+count=0
+failed=0
+for program in tests/programs/*.eva; do
+    expected=$(cat "${program%.eva}.out")
+    for level in -O0 -O2; do
+        for mode in --codegen-threads=1 --codegen-threads=2 --lazy; do
+            actual=$(./tests/EvaLLVM --jit --emit=none $level $mode "$program" 2>&1 |
+                         grep -v '^Optimization (O')
+            if [ "$actual" != "$expected" ]; then
+                printf 'FAIL: %s %s %s\nexpected:\n%s\nactual:\n%s\n\n' \
+                       "$program" "$level" "$mode" "$expected" "$actual"
+                failed=1
+            fi
+        done
+    done
+    count=$((count + 1))
+done
+
+[ $failed -eq 0 ] && echo "OK: $count programs"
+exit $failed
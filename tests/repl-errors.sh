@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# Checks that malformed inputs to the REPL are reported as errors and the
+# session goes on. Builds tests/EvaLLVM first.
+#
+#   ./tests/repl-errors.sh
+
+cd "$(dirname "$0")/.."
+
+./tests/build.sh || exit $?
+
+inputs=(
+    '()'
+    '(var)'
+    '(var x)'
+    '(var (x) 1)'
+    '(set)'
+    '(set 1 2)'
+    '(def)'
+    '(def 1 () 2)'
+    # An empty list left by a form continued on the next line
+    '(printf "%d\n" (
+     ))'
+)
+
+output=$(printf '%s\n' "${inputs[@]}" '(printf "%d\n" 7)' |
+             ./tests/EvaLLVM --repl 2>&1)
+status=$?
+
+errors=$(grep -c '^Error: ' <<< "$output")
+if [ $status -ne 0 ] || [ "$errors" -ne ${#inputs[@]} ] || [ "$(tail -n 1 <<< "$output")" != 7 ]; then
+    printf 'FAIL (exit status %d):\n%s\n' "$status" "$output"
+    exit 1
+fi
+echo "OK: ${#inputs[@]} inputs"
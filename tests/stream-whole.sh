@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# Checks that a program file compiled as a stream, one top-level form at
+# a time (the default for files under 1 MB), prints the same as the whole
+# program compiled at once (--codegen-threads=2). Builds tests/EvaLLVM first.
+#
+#   ./tests/stream-whole.sh
+
+cd "$(dirname "$0")/.."
+
+./tests/build.sh || exit $?
+
+programs=(
+    # A top-level variable widened by a later form
+    '(var x 1)
+     (set x 2.5)
+     (printf "%f\n" x)'
+
+    # A parameter widened by a call in a later form
+    '(def f (x) (* x 2))
+     (printf "%ld\n" (f 5000000000))'
+
+    # A return type widened through a later call, and a recursive def
+    '(def twice (x) (+ x x))
+     (def fact (n) (if (<= n 1) 1 (* n (fact (- n 1)))))
+     (var y (twice 3))
+     (printf "%ld %ld\n" (twice 3000000000) (fact 20))
+     (printf "%d\n" y)'
+
+    # A top-level variable set in a loop of a later form
+    '(var i 0)
+     (var sum 0)
+     (while (< i 10) (set sum (+ sum i)) (set i (+ i 1)))
+     (set sum (+ sum 0.5))
+     (printf "%f %d\n" sum i)'
+)
+
+file=$(mktemp)
+trap 'rm -f "$file"' EXIT
+
+failed=0
+for program in "${programs[@]}"; do
+    printf '%s\n' "$program" > "$file"
+    streamed=$(./tests/EvaLLVM --jit --emit=none "$file" 2>&1)
+    whole=$(./tests/EvaLLVM --jit --emit=none --codegen-threads=2 "$file" 2>&1)
+    if [ "$streamed" != "$whole" ]; then
+        printf 'FAIL:\n%s\nstreamed:\n%s\nwhole program:\n%s\n\n' "$program" "$streamed" "$whole"
+        failed=1
+    fi
+done
+
+[ $failed -eq 0 ] && echo "OK: ${#programs[@]} programs"
+exit $failed